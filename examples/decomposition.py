@@ -0,0 +1,28 @@
+
+import time
+
+import numpy as np
+import mcubes
+
+print("Benchmark of the decompositions of the cells into tetrahedra...")
+
+# Sphere with a wavy surface in a 160 x 160 x 160 volume
+X, Y, Z = np.mgrid[:160, :160, :160]
+u = np.sqrt((X-80)**2 + (Y-80)**2 + (Z-80)**2) - 50 + 4 * np.sin(X / 6) * np.cos(Y / 7)
+
+
+def f(x, y, z):
+    return np.sqrt(x**2 + y**2 + z**2) - 0.8
+
+
+for decomposition in (6, 5):
+    start = time.perf_counter()
+    vertices, triangles = mcubes.marching_cubes(u, 0, decomposition=decomposition)
+    volume_time = time.perf_counter() - start
+
+    start = time.perf_counter()
+    mcubes.marching_cubes_func((-1, -1, -1), (1, 1, 1), 60, 60, 60, f, 0, decomposition=decomposition)
+    func_time = time.perf_counter() - start
+
+    print("{} tetrahedra: {} vertices, {} triangles, {:.3f} s (volume), {:.3f} s (function)".format(
+        decomposition, len(vertices), len(triangles), volume_time, func_time))
@@ -1,4 +1,7 @@
 
-from ._mcubes import marching_cubes, marching_cubes_func
-from .exporter import export_mesh, export_obj, export_off
+from ._mcubes import (marching_cubes, marching_cubes_func, marching_cubes_adaptive, marching_cubes_batch,
+                      marching_cubes_chunked, marching_cubes_count, marching_cubes_exact, marching_cubes_lod,
+                      marching_cubes_series, Mesher, decimate, optimize_vertex_cache)
+from .exporter import export_mesh, export_obj, export_off, export_compact, load_compact
+from .chunkstore import ChunkStore
 from .smoothing import smooth, smooth_constrained, smooth_gaussian
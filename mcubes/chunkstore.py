@@ -0,0 +1,49 @@
+
+import json
+import os
+
+import numpy as np
+
+
+class ChunkStore:
+    """
+    Minimal chunked volume stored in a directory, with one .npy file per
+    chunk. It implements the chunk-read interface of
+    `mcubes.marching_cubes_chunked` (`shape`, `chunks` and
+    `read_chunk(index)`).
+    """
+
+    def __init__(self, path):
+        self.path = path
+        with open(os.path.join(path, "volume.json")) as fh:
+            meta = json.load(fh)
+        self.shape = tuple(meta["shape"])
+        self.chunks = tuple(meta["chunks"])
+
+    @classmethod
+    def create(cls, path, volume, chunks):
+        """
+        Stores `volume` in the directory `path` split into chunks of shape
+        `chunks`, and returns the store.
+        """
+
+        volume = np.asarray(volume)
+        os.makedirs(path, exist_ok=True)
+        for index in np.ndindex(*(-(-n // c) for n, c in zip(volume.shape, chunks))):
+            region = tuple(slice(i * c, (i + 1) * c) for i, c in zip(index, chunks))
+            np.save(cls._chunk_path(path, index), volume[region])
+
+        with open(os.path.join(path, "volume.json"), "w") as fh:
+            json.dump({"shape": list(volume.shape), "chunks": list(chunks)}, fh)
+        return cls(path)
+
+    def read_chunk(self, index):
+        """
+        Returns the samples of the chunk with the given (i, j, k) index.
+        """
+
+        return np.load(self._chunk_path(self.path, index))
+
+    @staticmethod
+    def _chunk_path(path, index):
+        return os.path.join(path, "{}_{}_{}.npy".format(*index))
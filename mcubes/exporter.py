@@ -1,6 +1,8 @@
 
 import numpy as np
 
+from ._mcubes import write_compact, read_compact
+
 
 def export_obj(vertices, triangles, filename):
     """
@@ -61,3 +63,31 @@ def export_mesh(vertices, triangles, filename, mesh_name="mcubes_mesh"):
     mesh.scene = myscene
 
     mesh.write(filename)
+
+
+def export_compact(vertices, triangles, filename, origin=(0, 0, 0), spacing=(1, 1, 1), bits=16, block_size=65536):
+    """
+    Exports a mesh in the compact quantized binary format (.mcq).
+
+    The vertices are quantized relative to a grid with the given `origin` and
+    `spacing` (those of the volume the mesh was extracted from; the default
+    matches `marching_cubes` on an array): every coordinate is stored as a grid
+    index plus a `bits`-bit fraction of the spacing, so the maximum error is
+    `spacing / 2**(bits + 1)`. Only the coordinates off the grid point store a
+    fraction: vertices on grid edges need a single one, and those on the face
+    and body diagonals of the tetrahedra two or three. Faces are delta- and
+    varint-encoded. The file is written in blocks of `block_size` vertices or
+    faces, streaming the encoding, and the blocks are decoded in parallel.
+    """
+
+    write_compact(vertices, triangles, filename, origin, spacing, bits, block_size)
+
+
+def load_compact(filename, num_threads=0):
+    """
+    Loads a mesh in the compact quantized binary format (.mcq), decoding its
+    blocks with `num_threads` threads (all the hardware threads if
+    `num_threads` <= 0).
+    """
+
+    return read_compact(filename, num_threads)
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+
+    /*
+        Constructor of the class. Starts num_threads - 1 workers, since the thread calling run
+        also takes part in the work
+        @param num_threads The number of threads of the pool
+    */
+    ThreadPool(size_t num_threads) : job(nullptr), job_count(0), active_workers(0), next(0),
+                                     generation(0), pending(0), stopping(false) {
+        for (size_t w = 1; w < std::max<size_t>(num_threads, 1); ++w)
+        {
+            workers.push_back(std::thread(&ThreadPool::loop, this, w));
+        }
+    }
+
+    /*
+        Destructor of the class. Stops and joins the workers
+    */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    /*
+        Returns the number of threads of the pool, including the caller of run
+    */
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    /*
+        Calls task(worker, index) for every index in [0, count) and waits for all of them. The
+        indices are handed out dynamically to at most max_workers threads (all of them if it is 0).
+        worker is in [0, size()) and each worker runs its tasks one after another, so it can be
+        used to select per-thread buffers. Concurrent calls are run one after another. The first
+        exception thrown by a task is rethrown once the running tasks have finished
+        @param count The number of tasks
+        @param task The function run for every index
+        @param max_workers The maximum number of threads used
+    */
+    void run(size_t count, const std::function<void(size_t, size_t)>& task, size_t max_workers = 0) {
+        std::lock_guard<std::mutex> run_lock(run_mutex);
+        if (count == 0)
+        {
+            return;
+        }
+
+        size_t num_workers = max_workers == 0 ? size() : std::min(max_workers, size());
+        num_workers = std::min(num_workers, count);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &task;
+            job_count = count;
+            active_workers = num_workers;
+            pending = num_workers - 1;
+            next = 0;
+            error = nullptr;
+            ++generation;
+        }
+        wake.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        job = nullptr;
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+
+    std::vector<std::thread> workers;
+
+    // Serializes the calls to run
+    std::mutex run_mutex;
+
+    // Protects the state of the current job
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(size_t, size_t)>* job;
+    size_t job_count;
+    size_t active_workers;
+    std::atomic<size_t> next;
+    size_t generation;
+    size_t pending;
+    bool stopping;
+    std::exception_ptr error;
+
+    /*
+        Runs the tasks of the current job until there are none left
+    */
+    void work(size_t worker) {
+        for (size_t i = next++; i < job_count; i = next++)
+        {
+            try
+            {
+                (*job)(worker, i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                next = job_count;
+            }
+        }
+    }
+
+    /*
+        Main loop of the workers: waits for a new job and takes part in it if needed
+    */
+    void loop(size_t worker) {
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+            {
+                return;
+            }
+            seen = generation;
+            if (worker >= active_workers)
+            {
+                continue;
+            }
+
+            lock.unlock();
+            work(worker);
+            lock.lock();
+            if (--pending == 0)
+            {
+                done.notify_all();
+            }
+        }
+    }
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+class UnionFind
+{
+public:
+
+    // The parent of each element and the upper bound of the height of each tree
+    std::vector<size_t> parent;
+    std::vector<unsigned char> rank;
+
+    /*
+        Constructor of the class. Every element starts in its own set
+        @param n The number of elements
+    */
+    UnionFind(size_t n) : parent(n), rank(n, 0) {
+        for (size_t i = 0; i < n; ++i)
+        {
+            parent[i] = i;
+        }
+    }
+
+    /*
+        Returns the representative of the set containing element i
+        @param i An element
+        @return The root of the tree containing i
+    */
+    size_t find(size_t i) {
+        // Path halving: every visited node is linked to its grandparent
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    /*
+        Merges the sets containing elements a and b
+        @param a An element
+        @param b An element
+    */
+    void unite(size_t a, size_t b) {
+        a = find(a);
+        b = find(b);
+        if (a == b)
+        {
+            return;
+        }
+
+        // Union by rank keeps the trees shallow
+        if (rank[a] < rank[b])
+        {
+            parent[a] = b;
+        }
+        else if (rank[a] > rank[b])
+        {
+            parent[b] = a;
+        }
+        else
+        {
+            parent[b] = a;
+            ++rank[a];
+        }
+    }
+};
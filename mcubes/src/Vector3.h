@@ -12,6 +12,12 @@ public:
 
 	double info;
 
+	// Corners of the cell at the ends of the edge the point was interpolated on, and the parameter
+	// of the interpolation. Points built from a corner have both ends equal to it and t = 0
+	int corner0;
+	int corner1;
+	double t;
+
 	// The element of the vector
 	double x;
 	double y;
@@ -20,13 +26,13 @@ public:
 	/*
 	Constructor of the class
 	*/
-    Vector3() : x(0.0), y(0.0), z(0.0) { info = 0.0; }
-	Vector3(double x, double y, double z) : x(x), y(y), z(z) { info = 0.0; }
+    Vector3() : x(0.0), y(0.0), z(0.0) { info = 0.0; corner0 = corner1 = 0; t = 0.0; }
+	Vector3(double x, double y, double z) : x(x), y(y), z(z) { info = 0.0; corner0 = corner1 = 0; t = 0.0; }
 
 	/*
 	Returns the magnitude of the vector
 	*/
-	double magnitude() {
+	double magnitude() const {
         // Calculate the magnitude of the vector and return it
         return sqrt((this->x * this->x) + (this->y * this->y) + (this->z * this->z));
     }
@@ -34,96 +40,99 @@ public:
 	/*
 	Normalizes the vector
 	*/
-	Vector3* normalize() {
+	Vector3 normalize() const {
         // Get the magnitude of the vector
         double mag = this->magnitude();
 
         // If it has a magnitude then normalize it
         if (mag > 0)
         {
-            return new Vector3(this->x / mag, this->y / mag, this->z / mag);
+            return Vector3(this->x / mag, this->y / mag, this->z / mag);
         }
 
         // Since the vector has no magnitude then return a zero vector
-        return new Vector3(0, 0, 0);
+        return Vector3(0, 0, 0);
     }
 
 	/*
 	Multiply the vector by the given scalar
 	*/
-	Vector3* multiply(double s) {
+	Vector3 multiply(double s) const {
         // Multiply each component by the scalar
-        return new Vector3(this->x * s, this->y * s, this->z * s);
-    }
-
-	/*
-	Clones the vector
-	*/
-	Vector3* clone() {
-        return new Vector3(this->x, this->y, this->z);
+        return Vector3(this->x * s, this->y * s, this->z * s);
     }
 
 	/*
 	Adds the value of the given vector
 	*/
-	Vector3* add(Vector3* B) {
-        return new Vector3(this->x + B->x, this->y + B->y, this->z + B->z);
+	Vector3 add(const Vector3& B) const {
+        return Vector3(this->x + B.x, this->y + B.y, this->z + B.z);
     }
 
 	/*
 	Subtracts the values of the given vector
 	*/
-	Vector3* sub(Vector3* B) {
-        return new Vector3(this->x - B->x, this->y - B->y, this->z - B->z);
+	Vector3 sub(const Vector3& B) const {
+        return Vector3(this->x - B.x, this->y - B.y, this->z - B.z);
     }
 
 	/*
 	Calculates the dot product with vector B
 	*/
-	double dot(Vector3* B) {
-        return (this->x * B->x) + (this->y * B->y) + (this->z * B->z);
+	double dot(const Vector3& B) const {
+        return (this->x * B.x) + (this->y * B.y) + (this->z * B.z);
     }
 
 	/*
 	Calculates the cross product with vector B
 	*/
-	Vector3* cross(Vector3* B) {
+	Vector3 cross(const Vector3& B) const {
         // Calculate the cross product values
-        double i = (this->y * B->z) - (this->z * B->y);
-        double j = (this->z * B->x) - (this->x * B->z);
-        double k = (this->x * B->y) - (this->y * B->x);
+        double i = (this->y * B.z) - (this->z * B.y);
+        double j = (this->z * B.x) - (this->x * B.z);
+        double k = (this->x * B.y) - (this->y * B.x);
 
         // Return the new vector
-        return new Vector3(i, j, k);
+        return Vector3(i, j, k);
     }
 
 	/*
 	Calculates the square euclidean distance to another vector
 	*/
-	double squareDistance(Vector3* B) {
-        return ((B->x - this->x) * (B->x - this->x)) +
-               ((B->y - this->y) * (B->y - this->y)) +
-               ((B->z - this->z) * (B->z - this->z));
+	double squareDistance(const Vector3& B) const {
+        return ((B.x - this->x) * (B.x - this->x)) +
+               ((B.y - this->y) * (B.y - this->y)) +
+               ((B.z - this->z) * (B.z - this->z));
     }
 
 	/*
 	Calculates the euclidean distance to another vector
 	*/
-	double distance(Vector3* B) {
+	double distance(const Vector3& B) const {
         return sqrt(squareDistance(B));
     }
 
 	/*
-	Returns the intyerpolated point using parameter t and point B
+	Returns the intyerpolated point using parameter t and point B. The result records the
+	corners of both points and t, so the auxiliary channels can be interpolated alike
 	*/
-	Vector3* interpolate(double t, Vector3* B) {
-        return this->multiply(1.0 - t)->add(B->multiply(t));
+	Vector3 interpolate(double t, const Vector3& B) const {
+        // Written as A + t(B - A) so coordinates shared by both points are kept exactly
+        Vector3 result(this->x + t * (B.x - this->x),
+                       this->y + t * (B.y - this->y),
+                       this->z + t * (B.z - this->z));
+
+        result.corner0 = this->corner0;
+        result.corner1 = B.corner0;
+        result.t = t;
+
+        return result;
     }
 
 	/*
 	*/
-	bool equal(Vector3* B) const {
-        return (this->x == B->x && this->y == B->y && this->z == B->z);
+	bool equal(const Vector3& B) const {
+        return (this->x == B.x && this->y == B.y && this->z == B.z);
     }
 
 	bool operator==(const Vector3& b) const {
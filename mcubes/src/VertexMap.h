@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "Vector3.h"
+
+class VertexMap
+{
+public:
+
+    /*
+        Constructor of the class. The map starts empty and without storage
+    */
+    VertexMap() : count(0), stamp(1) {}
+
+    /*
+        Returns the number of vertices in the map
+    */
+    size_t size() const {
+        return count;
+    }
+
+    /*
+        Removes all the vertices of the map. The storage is kept for the next uses, and only the
+        stamp of the current use is changed
+    */
+    void clear() {
+        count = 0;
+        if (++stamp == 0)
+        {
+            // The stamps wrapped around: reset the slots once
+            for (auto& slot : slots)
+            {
+                slot.stamp = 0;
+            }
+            stamp = 1;
+        }
+    }
+
+    /*
+        Returns the index of the vertex at the position of V. If there is none, V is inserted with
+        the next index (the current size of the map). Positions are compared as in
+        std::unordered_map<Vector3, int, Vector3Hash>, so both give the same numbering
+        @param V A vertex
+        @param inserted Set to true if V has been inserted, otherwise false
+        @return The index of the vertex
+    */
+    int insert(const Vector3& V, bool& inserted) {
+        // Keep the load factor under 1/2
+        if (2 * (count + 1) > slots.size())
+        {
+            grow();
+        }
+
+        size_t hash = Vector3Hash()(V);
+        size_t mask = slots.size() - 1;
+        for (size_t i = scramble(hash) & mask;; i = (i + 1) & mask)
+        {
+            Slot& slot = slots[i];
+            if (slot.stamp != stamp)
+            {
+                slot = Slot{hash, V.x, V.y, V.z, static_cast<int>(count), stamp};
+                ++count;
+                inserted = true;
+                return slot.index;
+            }
+            if (slot.hash == hash && DBL_APPROX(slot.x, V.x) && DBL_APPROX(slot.y, V.y) && DBL_APPROX(slot.z, V.z))
+            {
+                inserted = false;
+                return slot.index;
+            }
+        }
+    }
+
+    /*
+        Returns the index of the vertex at the position of V, or -1 if there is none. Positions
+        are compared as in insert
+        @param V A vertex
+        @return The index of the vertex
+    */
+    int find(const Vector3& V) const {
+        if (slots.empty())
+        {
+            return -1;
+        }
+
+        size_t hash = Vector3Hash()(V);
+        size_t mask = slots.size() - 1;
+        for (size_t i = scramble(hash) & mask;; i = (i + 1) & mask)
+        {
+            const Slot& slot = slots[i];
+            if (slot.stamp != stamp)
+            {
+                return -1;
+            }
+            if (slot.hash == hash && DBL_APPROX(slot.x, V.x) && DBL_APPROX(slot.y, V.y) && DBL_APPROX(slot.z, V.z))
+            {
+                return slot.index;
+            }
+        }
+    }
+
+private:
+
+    struct Slot
+    {
+        size_t hash;
+        double x;
+        double y;
+        double z;
+        int index;
+
+        // The slot is used only if its stamp is the one of the current use of the map
+        uint32_t stamp;
+    };
+
+    // Power of two number of slots with linear probing
+    std::vector<Slot> slots;
+    size_t count;
+    uint32_t stamp;
+
+    /*
+        Spreads the bits of the hash, whose lower bits are poorly distributed
+    */
+    static size_t scramble(size_t hash) {
+        uint64_t h = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+
+    /*
+        Doubles the number of slots and inserts the current vertices again
+    */
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(old.empty() ? 64 : 2 * old.size(), Slot{0, 0.0, 0.0, 0.0, 0, 0});
+
+        size_t mask = slots.size() - 1;
+        for (auto& slot : old)
+        {
+            if (slot.stamp != stamp)
+            {
+                continue;
+            }
+            size_t i = scramble(slot.hash) & mask;
+            while (slots[i].stamp == stamp)
+            {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+    }
+};
@@ -3,8 +3,14 @@
 # cython: embedsignature = True
 
 # from libcpp.vector cimport vector
+import ctypes
+import os
+from concurrent.futures import ThreadPoolExecutor
+
 import numpy as np
 
+from cpython.pycapsule cimport PyCapsule_GetContext, PyCapsule_GetName, PyCapsule_GetPointer
+
 # Define PY_ARRAY_UNIQUE_SYMBOL
 cdef extern from "pyarray_symbol.h":
     pass
@@ -13,18 +19,228 @@ cimport numpy as np
 
 np.import_array()
 
+cdef extern from "marchingcubes.h":
+    ctypedef enum Decomposition "mc::Decomposition":
+        DECOMPOSITION_SIX "mc::Decomposition::six"
+        DECOMPOSITION_FIVE "mc::Decomposition::five"
+
+cdef extern from "mesher.h":
+    cdef cppclass CMesher "mc::Mesher":
+        CMesher(int, int, int, int, Decomposition) except +
+
+cdef extern from "timeseries.h":
+    cdef cppclass CTimeSeriesMesher "mc::TimeSeriesMesher":
+        CTimeSeriesMesher(int, int, int, int, int, Decomposition) except +
+        size_t num_bricks()
+
+cdef extern from "chunked.h":
+    cdef cppclass CChunkedMesher "mc::ChunkedMesher":
+        CChunkedMesher(Decomposition) except +
+
 cdef extern from "pywrapper.h":
-    cdef object c_marching_cubes "marching_cubes"(np.ndarray, double) except +
-    cdef object c_marching_cubes_func "marching_cubes_func"(tuple, tuple, int, int, int, object, double) except +
+    cdef cppclass ExtractionOptions:
+        bint cleanup
+        double tolerance
+        bint return_labels
+        size_t min_triangles
+        bint keep_largest
+        size_t cache_size
+        int decomposition
 
-def marching_cubes(np.ndarray volume, float isovalue):
-    
-    verts, faces = c_marching_cubes(volume, isovalue)
+    cdef object c_marching_cubes "marching_cubes"(np.ndarray, double, list, const ExtractionOptions&) except +
+    cdef object c_marching_cubes_func "marching_cubes_func"(
+        tuple, tuple, int, int, int, object, double, const ExtractionOptions&) except +
+    cdef object c_marching_cubes_cfunc "marching_cubes_cfunc"(
+        tuple, tuple, int, int, int, size_t, size_t, double, int, const ExtractionOptions&) except +
+    cdef object c_marching_cubes_adaptive "marching_cubes_adaptive"(
+        tuple, tuple, int, int, int, object, size_t, size_t, double, double, const ExtractionOptions&) except +
+    cdef object c_marching_cubes_count "marching_cubes_count"(np.ndarray, double, int, Decomposition) except +
+    cdef object c_marching_cubes_exact "marching_cubes_exact"(
+        np.ndarray, double, object, object, int, Decomposition) except +
+    cdef object c_marching_cubes_lod "marching_cubes_lod"(np.ndarray, double, int, int, int, Decomposition) except +
+    cdef object c_mesher_extract "mesher_extract"(CMesher&, np.ndarray, double, object, object) except +
+    cdef object c_series_extract "series_extract"(CTimeSeriesMesher&, np.ndarray, double) except +
+    cdef object c_marching_cubes_series "marching_cubes_series"(np.ndarray, double, int, int, Decomposition) except +
+    cdef object c_chunked_add_block "chunked_add_block"(CChunkedMesher&, np.ndarray, tuple, double) except +
+    cdef object c_chunked_result "chunked_result"(CChunkedMesher&) except +
+    cdef object c_marching_cubes_batch "marching_cubes_batch"(list, np.ndarray, int, Decomposition) except +
+    cdef object c_decimate "decimate"(np.ndarray, np.ndarray, size_t, double, int) except +
+    cdef object c_optimize_vertex_cache "optimize_vertex_cache"(np.ndarray, np.ndarray, size_t) except +
+    cdef object c_write_compact "write_compact"(np.ndarray, np.ndarray, const char*, object, object, int, size_t) except +
+    cdef object c_read_compact "read_compact"(const char*, int) except +
+
+
+cdef Decomposition _decomposition(decomposition) except *:
+    # Split of the cells of `decomposition` tetrahedra (see `marching_cubes`)
+    if decomposition == 5:
+        return DECOMPOSITION_FIVE
+    if decomposition == 6:
+        return DECOMPOSITION_SIX
+    raise ValueError("decomposition must be 5 or 6")
+
+
+cdef ExtractionOptions _extraction_options(bint cleanup, double tolerance,
+                                           bint return_labels, int min_triangles, bint keep_largest,
+                                           int cache_size, int decomposition=6) except *:
+
+    if not 0 <= tolerance < 0.5:
+        raise ValueError("tolerance must be in [0, 0.5)")
+
+    if min_triangles < 0:
+        raise ValueError("min_triangles cannot be negative")
+
+    if cache_size < 0:
+        raise ValueError("cache_size cannot be negative")
+
+    _decomposition(decomposition)
+
+    cdef ExtractionOptions options
+    options.cleanup = cleanup
+    options.tolerance = tolerance
+    options.return_labels = return_labels
+    options.min_triangles = min_triangles
+    options.keep_largest = keep_largest
+    options.cache_size = cache_size
+    options.decomposition = decomposition
+    return options
+
+
+def _unpack_result(result, num_attributes, return_attributes, return_labels, return_info):
+
+    verts, faces, vert_attrs, labels, info = result
     verts.shape = (-1, 3)
     faces.shape = (-1, 3)
-    return verts, faces
 
-def marching_cubes_func(tuple lower, tuple upper, int numx, int numy, int numz, object f, double isovalue):
+    output = (verts, faces)
+    if return_attributes:
+        # The number of vertices cannot be inferred from an empty array
+        if num_attributes > 0:
+            vert_attrs.shape = (num_attributes, -1)
+            output += (list(vert_attrs),)
+        else:
+            output += ([],)
+    if return_labels:
+        output += (labels,)
+    if return_info:
+        output += (info,)
+    return output
+
+
+_NATIVE_SIGNATURE = "double (double, double, double, void *)"
+_NATIVE_ARGTYPES = (ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_void_p)
+
+
+def _native_function(f, user_data):
+    """
+    Returns the addresses (function, user_data) of a native implicit function
+    with signature `double(double, double, double, void*)`, or None if `f` is
+    a regular Python callable.
+    """
+
+    cdef object capsule
+    cdef bytes name
+
+    try:
+        from scipy import LowLevelCallable
+    except ImportError:
+        LowLevelCallable = ()
+
+    if isinstance(f, LowLevelCallable):
+        # LowLevelCallable is a tuple (capsule, function, user_data)
+        if user_data is not None:
+            raise ValueError("user_data cannot be given with a LowLevelCallable, which carries its own")
+        capsule = tuple.__getitem__(f, 0)
+        name = PyCapsule_GetName(capsule) or b""
+        if name.decode() != _NATIVE_SIGNATURE:
+            raise ValueError("LowLevelCallable must have signature '{}'".format(_NATIVE_SIGNATURE))
+        return (<size_t>PyCapsule_GetPointer(capsule, PyCapsule_GetName(capsule)),
+                <size_t>PyCapsule_GetContext(capsule))
+
+    # Numba cfuncs expose their ctypes function pointer
+    if hasattr(f, "address") and hasattr(f, "ctypes"):
+        f = f.ctypes
+
+    if isinstance(f, ctypes._CFuncPtr):
+        if f.restype is not ctypes.c_double or (f.argtypes is not None and tuple(f.argtypes) != _NATIVE_ARGTYPES):
+            raise ValueError("ctypes function must have signature '{}'".format(_NATIVE_SIGNATURE))
+        if user_data is None:
+            data = 0
+        elif isinstance(user_data, int):
+            data = user_data
+        else:
+            data = ctypes.cast(user_data, ctypes.c_void_p).value or 0
+        return ctypes.cast(f, ctypes.c_void_p).value, data
+
+    return None
+
+
+def marching_cubes(np.ndarray volume, float isovalue, attributes=None,
+                   return_labels=False, min_triangles=0, keep_largest=False,
+                   cleanup=False, tolerance=1e-3, cache_size=0, return_info=False, decomposition=6):
+    """
+    Extracts the isosurface of `volume` at the given isovalue.
+
+    `attributes` is an optional sequence of arrays with the same shape as
+    `volume` (e.g., labels, density or color channels). When given, each of
+    them is linearly interpolated at the vertices of the mesh and the list of
+    per-vertex arrays is returned as a third output.
+
+    When `return_labels` is set, the connected shells of the mesh are labelled
+    once the mesh is built, in a pass over its faces within the same native
+    call, and the shell label of every face (0 being the largest shell) is
+    returned as an extra output. The same pass filters them: shells with less
+    than `min_triangles` faces are dropped, and `keep_largest` keeps only the
+    largest one.
+
+    With `cleanup`, vertices closer than `tolerance` (relative to the cell
+    size) to a grid corner are snapped to it, and collapsed or zero-area
+    triangles are removed from the compacted mesh.
+
+    With a positive `cache_size`, the faces are reordered for a GPU
+    post-transform vertex cache of that many entries and the vertices are
+    renumbered in the order the faces use them (see `optimize_vertex_cache`).
+
+    `decomposition` is the number of tetrahedra every cell is split into: 6
+    (around the same diagonal in all the cells), or 5, alternating between
+    the two mirrored splits like a checkerboard so the faces of neighbouring
+    cells match. Both give closed meshes; 5 gives about 20% less triangles
+    and is faster, 6 gives more regular triangles.
+
+    With `return_info`, a dict with statistics of the optional stages (e.g.,
+    the number of `removed_triangles`, or the `acmr_before` and `acmr_after`
+    the cache optimization) is returned as the last output.
+    """
+
+    attrs = [] if attributes is None else [np.asarray(a) for a in attributes]
+    if any(a.shape != (<object>volume).shape for a in attrs):
+        raise ValueError("attributes must have the same shape as the volume")
+
+    options = _extraction_options(cleanup, tolerance, return_labels, min_triangles, keep_largest, cache_size,
+                                  decomposition)
+    result = c_marching_cubes(volume, isovalue, attrs, options)
+    return _unpack_result(result, len(attrs), attributes is not None, return_labels, return_info)
+
+def marching_cubes_func(tuple lower, tuple upper, int numx, int numy, int numz, object f, double isovalue,
+                        return_labels=False, min_triangles=0, keep_largest=False,
+                        cleanup=False, tolerance=1e-3, cache_size=0, return_info=False,
+                        user_data=None, int num_threads=1, decomposition=6):
+    """
+    Extracts the isosurface of the function `f(x, y, z)` sampled in a grid of
+    `numx * numy * numz` points between `lower` and `upper`.
+
+    Besides Python callables, `f` can be a native function with signature
+    `double(double x, double y, double z, void* user_data)`: a
+    `scipy.LowLevelCallable`, a ctypes function pointer or a Numba `cfunc`.
+    Native functions are evaluated in C++ with the GIL released, and both the
+    sampling and the marching of the grid are split among `num_threads`
+    threads (all the hardware threads if `num_threads` <= 0), with the same
+    mesh as a single thread. They receive `user_data` (an address or a ctypes
+    pointer) as last argument; a `LowLevelCallable` carries its own and
+    cannot be given `user_data`. Native functions must be thread-safe when
+    `num_threads` != 1.
+
+    See `marching_cubes` for the rest of the arguments.
+    """
     
     if any(l_i >= u_i for l_i, u_i in zip(lower, upper)):
         raise ValueError("lower coordinates cannot be larger than upper coordinates")
@@ -32,7 +248,473 @@ def marching_cubes_func(tuple lower, tuple upper, int numx, int numy, int numz,
     if numx < 2 or numy < 2 or numz < 2:
         raise ValueError("numx, numy, numz cannot be smaller than 2")
 
-    verts, faces = c_marching_cubes_func(lower, upper, numx, numy, numz, f, isovalue)
+    options = _extraction_options(cleanup, tolerance, return_labels, min_triangles, keep_largest, cache_size,
+                                  decomposition)
+    native = _native_function(f, user_data)
+    if native is None:
+        result = c_marching_cubes_func(lower, upper, numx, numy, numz, f, isovalue, options)
+    else:
+        result = c_marching_cubes_cfunc(lower, upper, numx, numy, numz, native[0], native[1], isovalue,
+                                        num_threads, options)
+    return _unpack_result(result, 0, False, return_labels, return_info)
+
+def marching_cubes_adaptive(tuple lower, tuple upper, cell_size, object f, double isovalue, lipschitz=None,
+                            return_labels=False, min_triangles=0, keep_largest=False,
+                            cleanup=False, tolerance=1e-3, cache_size=0, return_info=False, user_data=None,
+                            decomposition=6):
+    """
+    Extracts the isosurface of the function `f(x, y, z)` between `lower` and
+    `upper` evaluating it only where the surface may be, with an octree
+    refined down to cells of about `cell_size` (a number or one size per
+    axis). The mesh is the one `marching_cubes_func` gives on that grid with
+    the same `decomposition` whenever every crossed cell is found.
+
+    If `lipschitz` is given, it must be an upper bound of the Lipschitz
+    constant of `f` (e.g., 1 for signed distance functions) and no part of the
+    surface is missed. Otherwise octree blocks of 8 cells without a sign change
+    at their corners are discarded, which may miss small features. In both
+    cases the surface found is followed through the grid, so the extracted
+    components are closed.
+
+    The info dict (see `return_info`) reports the number of `evaluations` of
+    `f` and the `saved_evaluations` with respect to the full grid. `f` can be a
+    native function as in `marching_cubes_func`, which is evaluated with the
+    GIL released. See `marching_cubes` for the rest of the arguments.
+    """
+
+    if any(l_i >= u_i for l_i, u_i in zip(lower, upper)):
+        raise ValueError("lower coordinates cannot be larger than upper coordinates")
+
+    cell_size = np.broadcast_to(np.asarray(cell_size, dtype=np.float64), (3,))
+    if np.any(cell_size <= 0):
+        raise ValueError("cell_size must be positive")
+
+    if lipschitz is not None and lipschitz <= 0:
+        raise ValueError("lipschitz must be positive")
+
+    numx, numy, numz = (max(2, int(round((u_i - l_i) / c_i)) + 1)
+                        for l_i, u_i, c_i in zip(lower, upper, cell_size))
+
+    options = _extraction_options(cleanup, tolerance, return_labels, min_triangles, keep_largest, cache_size,
+                                  decomposition)
+    native = _native_function(f, user_data) or (0, 0)
+    result = c_marching_cubes_adaptive(lower, upper, numx, numy, numz, f, native[0], native[1], isovalue,
+                                       0.0 if lipschitz is None else lipschitz, options)
+    return _unpack_result(result, 0, False, return_labels, return_info)
+
+def marching_cubes_count(volume, double isovalue, int num_threads=0, decomposition=6):
+    """
+    Returns the numbers of vertices and faces of the mesh `marching_cubes_exact`
+    extracts from `volume` with the same `decomposition`, computed from the
+    signs of the samples only. Use it to allocate the output buffers of
+    `marching_cubes_exact`.
+    """
+
+    cdef Decomposition split = _decomposition(decomposition)
+    vol = np.ascontiguousarray(volume, dtype=np.float64)
+    if vol.ndim != 3:
+        raise ValueError("volume must be a three-dimensional array")
+    return c_marching_cubes_count(vol, isovalue, num_threads, split)
+
+def marching_cubes_exact(volume, double isovalue, out_vertices=None, out_faces=None, int num_threads=0,
+                         decomposition=6):
+    """
+    Extracts the isosurface of `volume` in two passes. The first pass counts
+    the vertices and faces of every slab of the volume from the signs of the
+    samples, and the second one writes the mesh in parallel directly into
+    buffers of the exact size, so the output never grows nor is copied.
+
+    `out_vertices` and `out_faces` are optional preallocated buffers, a
+    contiguous float64 array of shape (N, 3) and a contiguous array of shape
+    (M, 3) with the dtype of the faces returned by `marching_cubes` (see
+    `marching_cubes_count` for their minimum sizes). They are filled from the
+    start and views of their used rows are returned. Otherwise new arrays of
+    the exact size are returned. Invalid output buffers raise ValueError. The
+    passes are split among `num_threads` threads (all the hardware threads if
+    `num_threads` <= 0) with the GIL released.
+
+    The mesh is the one of `marching_cubes` with the same `decomposition`,
+    with the vertices numbered by grid edge instead of by order of appearance.
+    The cut edges ending at a sample equal to the isovalue share a single
+    vertex at that sample, and the faces collapsed to it are dropped, so
+    integer volumes give the same connected mesh. Only vertices closer than
+    the merging tolerance of `marching_cubes` without coinciding are kept
+    apart.
+    """
+
+    cdef Decomposition split = _decomposition(decomposition)
+    vol = np.ascontiguousarray(volume, dtype=np.float64)
+    if vol.ndim != 3:
+        raise ValueError("volume must be a three-dimensional array")
+
+    verts, faces, num_vertices, num_faces = c_marching_cubes_exact(vol, isovalue, out_vertices, out_faces,
+                                                                   num_threads, split)
+
+    verts = verts.reshape(-1, 3)[:num_vertices]
+    faces = faces.reshape(-1, 3)[:num_faces]
+    return verts, faces
+
+_PYRAMID_MODES = {"mean": 0, "min": 1, "max": 2}
+
+def marching_cubes_lod(volume, double isovalue, int levels=4, mode="mean", int num_threads=0, decomposition=6):
+    """
+    Extracts the isosurface of `volume` at several levels of detail in one
+    call. The volume pyramid is built on the fly, every level from the
+    previous one, halving the resolution: a sample of the next level reduces
+    the 3x3x3 samples around every other sample of the current one with
+    `mode`:
+
+      - "mean": weighted average (weights 1, 2, 1 along every axis),
+      - "min" or "max": minimum or maximum, so the regions below (or above)
+        the isovalue never vanish in the coarse levels.
+
+    Every level is extracted with the two passes of `marching_cubes_exact`
+    (with the given `decomposition`) on `num_threads` threads (all the
+    hardware threads if `num_threads` <= 0) while the next level is built in
+    another thread.
+
+    Returns a list with the (vertices, faces) of every level, from the full
+    resolution to the coarsest one, in arrays of the exact size and with the
+    vertices in the coordinates of `volume`. There are at most `levels` levels;
+    fewer if the volume is too small.
+    """
+
+    cdef Decomposition split = _decomposition(decomposition)
+    if levels < 1:
+        raise ValueError("levels must be positive")
+    if mode not in _PYRAMID_MODES:
+        raise ValueError("mode must be one of {}".format(", ".join(map(repr, _PYRAMID_MODES))))
+
+    vol = np.ascontiguousarray(volume, dtype=np.float64)
+    if vol.ndim != 3 or min(vol.shape) < 2:
+        raise ValueError("volume must be a three-dimensional array with at least two samples per axis")
+
+    meshes = c_marching_cubes_lod(vol, isovalue, levels, _PYRAMID_MODES[mode], num_threads, split)
+    return [(verts.reshape(-1, 3), faces.reshape(-1, 3)) for verts, faces in meshes]
+
+cdef class Mesher:
+    """
+    Reusable extractor for volumes of a fixed `shape`, for applications that
+    mesh many volumes of the same size (e.g., in a real-time loop).
+
+    Calling the mesher runs the two-pass extraction of `marching_cubes_exact`
+    with `num_threads` threads and the given `decomposition`, keeping its scratch structures from one call
+    to the next. When `out_vertices` and `out_faces` are given and large
+    enough, the mesh is written into them and views of their used rows are
+    returned; otherwise new arrays are returned. Buffers with the wrong dtype
+    or layout, read-only or whose size is not a multiple of 3 raise
+    ValueError. With a single thread and large enough buffers, the calls do
+    not allocate memory once the scratch structures have grown to the largest
+    mesh. Calls from several Python threads to the same mesher
+    are run one after another.
+    """
+
+    cdef CMesher* mesher
+    cdef readonly tuple shape
+
+    def __cinit__(self, shape, int num_threads=1, decomposition=6):
+        numx, numy, numz = shape
+        self.mesher = new CMesher(numx, numy, numz, num_threads, _decomposition(decomposition))
+        self.shape = (numx, numy, numz)
+
+    def __dealloc__(self):
+        del self.mesher
+
+    def __call__(self, volume, double isovalue, out_vertices=None, out_faces=None):
+        vol = np.ascontiguousarray(volume, dtype=np.float64)
+        if vol.shape != self.shape:
+            raise ValueError("volume must have shape {}".format(self.shape))
+
+        verts, faces, num_vertices, num_faces = c_mesher_extract(self.mesher[0], vol, isovalue,
+                                                                 out_vertices, out_faces)
+        return verts.reshape(-1, 3)[:num_vertices], faces.reshape(-1, 3)[:num_faces]
+
+def marching_cubes_series(frames, double isovalue, int brick_size=16, int num_threads=0, return_info=False,
+                          decomposition=6):
+    """
+    Extracts the isosurface of every frame of a time series, given as an
+    array of shape (T, X, Y, Z) or an iterable of arrays of shape (X, Y, Z).
+
+    The grid is split into bricks of `brick_size` cells per axis. A brick whose
+    samples stay above, on or below the isovalue from one frame to the next
+    reuses the faces of the previous frame, and only the other bricks are
+    marched again; the vertices are interpolated in every frame. The meshes
+    are those of `marching_cubes_exact` with the same `decomposition`, with
+    the faces grouped by brick.
+
+    For an array, the frames are split into runs of consecutive frames that are
+    extracted in parallel (the first frame of every run is marched completely).
+    Frames from an iterable are extracted one after another, splitting their
+    bricks among the threads. `num_threads` <= 0 uses all the hardware threads.
+
+    Returns a list with the (vertices, faces) of every frame. With
+    `return_info`, a dict with the number of bricks of the grid (`num_bricks`)
+    and the number of bricks marched in every frame (`marched_bricks`) is also
+    returned.
+    """
+
+    cdef CTimeSeriesMesher* mesher
+    cdef Decomposition split = _decomposition(decomposition)
+    if brick_size < 1:
+        raise ValueError("brick_size must be positive")
+
+    if isinstance(frames, np.ndarray) and frames.ndim == 4:
+        vol = np.ascontiguousarray(frames, dtype=np.float64)
+        if min(vol.shape[1:]) < 2:
+            raise ValueError("frames must have at least two samples per axis")
+        results = c_marching_cubes_series(vol, isovalue, brick_size, num_threads, split)
+        shape = vol.shape[1:]
+    else:
+        results = []
+        mesher = NULL
+        shape = None
+        try:
+            for frame in frames:
+                vol = np.ascontiguousarray(frame, dtype=np.float64)
+                if shape is None:
+                    if vol.ndim != 3 or min(vol.shape) < 2:
+                        raise ValueError("frames must be three-dimensional arrays with at least two samples per axis")
+                    shape = vol.shape
+                    mesher = new CTimeSeriesMesher(shape[0], shape[1], shape[2], brick_size,
+                                                   num_threads if num_threads > 0 else (os.cpu_count() or 1), split)
+                elif vol.shape != shape:
+                    raise ValueError("frames must have the same shape")
+                results.append(c_series_extract(mesher[0], vol, isovalue))
+        finally:
+            del mesher
+
+    meshes = [(verts.reshape(-1, 3), faces.reshape(-1, 3)) for verts, faces, _ in results]
+    if return_info:
+        num_bricks = 0
+        if shape is not None:
+            num_bricks = np.prod([(n - 2) // brick_size + 1 for n in shape])
+        info = {"num_bricks": int(num_bricks), "marched_bricks": np.array([r[2] for r in results], dtype=int)}
+        return meshes, info
+    return meshes
+
+def marching_cubes_chunked(source, double isovalue, prefetch=True, decomposition=6):
+    """
+    Extracts the isosurface of a chunked volume that does not need to fit in
+    memory. `source` is any object with a `shape` and a chunk shape `chunks`
+    (three integers each) and a method `read_chunk(index)` returning the
+    samples of the chunk at the given (i, j, k) chunk index as an array (of
+    shape `chunks`, or smaller at the upper borders of the volume).
+
+    The chunks are visited in x, y, z order, so the neighbours of a chunk
+    across its lower faces have already been read when it is meshed. Only the
+    layer of samples shared with them is kept (a plane of the volume, a row of
+    chunks and a chunk face), and every chunk is meshed together with that
+    layer. With `prefetch`, the next chunk is read in a background thread
+    while the current one is meshed with the GIL released.
+
+    Returns the vertices and faces of `marching_cubes` on the whole volume
+    with the same `decomposition`, up to the numbering of the vertices.
+    """
+
+    cdef CChunkedMesher* mesher
+    cdef Decomposition split = _decomposition(decomposition)
+    shape = tuple(int(n) for n in source.shape)
+    chunks = tuple(int(n) for n in source.chunks)
+    if len(shape) != 3 or len(chunks) != 3:
+        raise ValueError("source must have a three-dimensional shape and chunk shape")
+    if min(shape) < 2 or min(chunks) < 1:
+        raise ValueError("source must have at least two samples per axis and non-empty chunks")
+
+    grid = [-(-n // c) for n, c in zip(shape, chunks)]
+    indices = [(i, j, k) for i in range(grid[0]) for j in range(grid[1]) for k in range(grid[2])]
+
+    # Halos: the last sample layer of the previous slab of chunks along x, of the previous row of
+    # chunks along y and of the previous chunk along z. The first two are read by the current
+    # slab or row while the next ones are written
+    x_halos = [np.empty(shape[1:]), np.empty(shape[1:])]
+    y_halos = [np.empty((chunks[0], shape[2])), np.empty((chunks[0], shape[2]))]
+    z_halo = np.empty(chunks[:2])
+
+    def read(index):
+        return np.ascontiguousarray(source.read_chunk(index), dtype=np.float64)
+
+    executor = ThreadPoolExecutor(max_workers=1) if prefetch else None
+    mesher = new CChunkedMesher(split)
+    try:
+        pending = executor.submit(read, indices[0]) if prefetch else None
+        for n, index in enumerate(indices):
+            if prefetch:
+                chunk = pending.result()
+                if n + 1 < len(indices):
+                    pending = executor.submit(read, indices[n + 1])
+            else:
+                chunk = read(index)
+
+            start = [index[a] * chunks[a] for a in range(3)]
+            end = [min(start[a] + chunks[a], shape[a]) for a in range(3)]
+            if chunk.shape != tuple(end[a] - start[a] for a in range(3)):
+                raise ValueError("chunk {} has shape {}".format(index, chunk.shape))
+
+            # The chunk with the layers shared with the previous chunks
+            h = [1 if index[a] > 0 else 0 for a in range(3)]
+            sx, sy, sz = chunk.shape
+            block = np.empty((sx + h[0], sy + h[1], sz + h[2]))
+            block[h[0]:, h[1]:, h[2]:] = chunk
+            if h[0]:
+                block[0] = x_halos[0][start[1] - h[1]:end[1], start[2] - h[2]:end[2]]
+            if h[1]:
+                block[h[0]:, 0] = y_halos[0][:sx, start[2] - h[2]:end[2]]
+            if h[2]:
+                block[h[0]:, h[1]:, 0] = z_halo[:sx, :sy]
+
+            x_halos[1][start[1]:end[1], start[2]:end[2]] = chunk[-1]
+            y_halos[1][:sx, start[2]:end[2]] = chunk[:, -1]
+            z_halo[:sx, :sy] = chunk[:, :, -1]
+
+            # The halos written by a row or a slab are read by the next one
+            if index[2] == grid[2] - 1:
+                y_halos.reverse()
+                if index[1] == grid[1] - 1:
+                    x_halos.reverse()
+
+            offset = tuple(start[a] - h[a] for a in range(3))
+            c_chunked_add_block(mesher[0], block, offset, isovalue)
+
+        verts, faces = c_chunked_result(mesher[0])
+    finally:
+        del mesher
+        if prefetch:
+            executor.shutdown(wait=True)
+
     verts.shape = (-1, 3)
     faces.shape = (-1, 3)
     return verts, faces
+
+def marching_cubes_batch(volumes, isovalues, int num_threads=0, decomposition=6):
+    """
+    Extracts the isosurfaces of many volumes in a single call.
+
+    `volumes` is a sequence of three-dimensional arrays, possibly of different
+    shapes, or a four-dimensional array stacking volumes of the same shape.
+    `isovalues` is a single isovalue or one per volume. The extractions run
+    with the GIL released on a thread pool shared by all the calls, using at
+    most `num_threads` threads (all the hardware threads if `num_threads` <= 0),
+    and every thread reuses its buffers from one volume to the next.
+
+    Returns the concatenated `vertices` and `faces` of all the meshes and two
+    arrays `vertex_offsets` and `face_offsets` of length `len(volumes) + 1`.
+    The mesh of the i-th volume is
+
+        vertices[vertex_offsets[i]:vertex_offsets[i + 1]]
+        faces[face_offsets[i]:face_offsets[i + 1]]
+
+    and its faces index its own vertices (starting at 0), so each slice is the
+    output of `marching_cubes(volumes[i], isovalues[i], decomposition=decomposition)`.
+    """
+
+    cdef Decomposition split = _decomposition(decomposition)
+    if isinstance(volumes, np.ndarray):
+        if volumes.ndim != 4:
+            raise ValueError("stacked volumes must be a four-dimensional array")
+        volumes = np.ascontiguousarray(volumes, dtype=np.float64)
+
+    vols = [np.ascontiguousarray(v, dtype=np.float64) for v in volumes]
+    if any(v.ndim != 3 for v in vols):
+        raise ValueError("volumes must be three-dimensional arrays")
+
+    isos = np.asarray(isovalues, dtype=np.float64)
+    if isos.ndim > 1 or (isos.ndim == 1 and len(isos) != len(vols)):
+        raise ValueError("isovalues must be a single value or one per volume")
+    isos = np.ascontiguousarray(np.broadcast_to(isos, (len(vols),)))
+
+    verts, faces, vertex_offsets, face_offsets = c_marching_cubes_batch(vols, isos, num_threads, split)
+    verts.shape = (-1, 3)
+    faces.shape = (-1, 3)
+    return verts, faces, vertex_offsets, face_offsets
+
+def decimate(vertices, faces, target_triangles=None, max_error=None, int num_threads=0):
+    """
+    Simplifies a mesh with quadric error metric edge collapses.
+
+    Edges are collapsed until the mesh has at most `target_triangles` faces or
+    the quadric error of the next collapse (a sum of squared distances to the
+    planes of the original faces) exceeds `max_error`. At least one of them
+    must be given. The mesh is split into `num_threads` slabs that are
+    simplified in parallel (all the hardware threads if `num_threads` <= 0),
+    and the GIL is released during the simplification.
+
+    Returns the simplified vertices and faces.
+    """
+
+    if target_triangles is None and max_error is None:
+        raise ValueError("either target_triangles or max_error must be given")
+
+    if target_triangles is not None and target_triangles < 0:
+        raise ValueError("target_triangles cannot be negative")
+
+    verts = np.ascontiguousarray(vertices, dtype=np.float64)
+    tris = np.ascontiguousarray(faces, dtype="L")  # C unsigned long, as returned by marching_cubes
+    if verts.ndim != 2 or verts.shape[1] != 3 or tris.ndim != 2 or tris.shape[1] != 3:
+        raise ValueError("vertices and faces must be arrays of shape (N, 3)")
+
+    target = 0 if target_triangles is None else target_triangles
+    error = np.inf if max_error is None else max_error
+
+    verts, tris = c_decimate(verts, tris, target, error, num_threads)
+    verts.shape = (-1, 3)
+    tris.shape = (-1, 3)
+    return verts, tris
+
+def optimize_vertex_cache(vertices, faces, int cache_size=16, return_info=False):
+    """
+    Reorders the faces of a mesh for a GPU post-transform vertex cache of
+    `cache_size` entries with the Tipsify algorithm, and renumbers the vertices
+    in the order the reordered faces use them so vertex fetches are mostly
+    sequential. The orientation of the faces is kept. Runs in linear time.
+
+    Returns the reordered vertices and faces. With `return_info`, a dict with
+    the average cache miss ratio (transformed vertices per face with a FIFO
+    cache) `acmr_before` and `acmr_after` the reordering is also returned.
+    """
+
+    if cache_size < 1:
+        raise ValueError("cache_size must be positive")
+
+    verts = np.ascontiguousarray(vertices, dtype=np.float64)
+    tris = np.ascontiguousarray(faces, dtype="L")
+    if verts.ndim != 2 or verts.shape[1] != 3 or tris.ndim != 2 or tris.shape[1] != 3:
+        raise ValueError("vertices and faces must be arrays of shape (N, 3)")
+
+    verts, tris, info = c_optimize_vertex_cache(verts, tris, cache_size)
+    verts.shape = (-1, 3)
+    tris.shape = (-1, 3)
+    if return_info:
+        return verts, tris, info
+    return verts, tris
+
+def write_compact(vertices, faces, filename, origin=(0, 0, 0), spacing=(1, 1, 1), int bits=16,
+                  int block_size=65536):
+    """
+    Writes a mesh in the compact quantized format. See `mcubes.export_compact`.
+    """
+
+    if len(origin) != 3 or len(spacing) != 3:
+        raise ValueError("origin and spacing must have three coordinates")
+    if any(s <= 0 for s in spacing):
+        raise ValueError("spacing must be positive")
+    if not 1 <= bits <= 24:
+        raise ValueError("bits must be in [1, 24]")
+    if block_size < 1:
+        raise ValueError("block_size must be positive")
+
+    verts = np.ascontiguousarray(vertices, dtype=np.float64)
+    tris = np.ascontiguousarray(faces, dtype="L")
+    if verts.ndim != 2 or verts.shape[1] != 3 or tris.ndim != 2 or tris.shape[1] != 3:
+        raise ValueError("vertices and faces must be arrays of shape (N, 3)")
+
+    c_write_compact(verts, tris, os.fsencode(filename), tuple(origin), tuple(spacing), bits, block_size)
+
+def read_compact(filename, int num_threads=0):
+    """
+    Reads a mesh in the compact quantized format. See `mcubes.load_compact`.
+    """
+
+    verts, tris = c_read_compact(os.fsencode(filename), num_threads)
+    verts.shape = (-1, 3)
+    tris.shape = (-1, 3)
+    return verts, tris
@@ -0,0 +1,109 @@
+
+#ifndef _CHUNKED_H
+#define _CHUNKED_H
+
+#include <stddef.h>
+#include <array>
+#include <vector>
+#include "marchingcubes.h"
+
+namespace mc
+{
+
+/*
+    Extracts the isosurface of a volume given as a sequence of blocks, such as the chunks of a
+    chunked store. Every block must contain the samples of its cells, including the layer of grid
+    points shared with the next blocks along every axis, and the blocks must not overlap in
+    cells. The vertices are merged by position across blocks as in marching_cubes, so the result
+    is the mesh marching_cubes gives on the whole volume, with the vertices numbered in the order
+    the blocks are added
+*/
+class ChunkedMesher
+{
+public:
+
+    /*
+        Constructor of the class
+        @param decomposition The split of the cells into tetrahedra
+    */
+    explicit ChunkedMesher(Decomposition decomposition = Decomposition::six) : decomposition(decomposition) {}
+
+    /*
+        Marches the cells of a block and adds its triangles to the mesh
+        @param block The samples of the block, indexed as block[(x * numy + y) * numz + z]
+        @param numx, numy, numz The shape of the block
+        @param offset The position of the first sample of the block in the volume
+    */
+    void add_block(const double* block, int numx, int numy, int numz, const std::array<long, 3>& offset,
+                   double isovalue) {
+        using namespace private_;
+
+        const long numyz = static_cast<long>(numy) * numz;
+        auto sample = [&](long x, long y, long z) -> double {
+            return block[(x - offset[0]) * numyz + (y - offset[1]) * numz + (z - offset[2])];
+        };
+        auto no_attributes = [](long, long, long, double*) {};
+
+        for (long x = offset[0]; x < offset[0] + numx - 1; ++x)
+        {
+            for (long y = offset[1]; y < offset[1] + numy - 1; ++y)
+            {
+                double v[8];
+                v[4] = sample(x, y, offset[2]); v[5] = sample(x + 1, y, offset[2]);
+                v[6] = sample(x + 1, y + 1, offset[2]); v[7] = sample(x, y + 1, offset[2]);
+
+                for (long z = offset[2]; z < offset[2] + numz - 1; ++z)
+                {
+                    // 0-8: (---)(+--)(++-)(-+-)(--+)(+-+)(+++)(-++)
+                    v[0] = v[4]; v[1] = v[5];
+                    v[2] = v[6]; v[3] = v[7];
+                    v[4] = sample(x, y, z + 1); v[5] = sample(x + 1, y, z + 1);
+                    v[6] = sample(x + 1, y + 1, z + 1); v[7] = sample(x, y + 1, z + 1);
+
+                    // The parity of the cells is the one of their position in the volume
+                    workspace.triangles.clear();
+                    if (decomposition == Decomposition::five)
+                    {
+                        marchCell<Decomposition::five>(x, x + 1, y, y + 1, z, z + 1, v, isovalue, no_attributes, 0,
+                                                       nullptr, 0.0, workspace.triangles, (x + y + z) & 1);
+                    }
+                    else
+                    {
+                        marchCell(x, x + 1, y, y + 1, z, z + 1, v, isovalue, no_attributes, 0, nullptr, 0.0,
+                                  workspace.triangles);
+                    }
+                    addTriangles(workspace.triangles, workspace.vertex_map, vertices, polygons, attributes, 0, nullptr);
+                }
+            }
+        }
+    }
+
+    /*
+        Returns the vertices of the mesh, three coordinates per vertex
+    */
+    std::vector<double>& get_vertices() {
+        return vertices;
+    }
+
+    /*
+        Returns the triangles of the mesh, three indices per triangle
+    */
+    std::vector<size_t>& get_polygons() {
+        return polygons;
+    }
+
+private:
+
+    Decomposition decomposition;
+
+    // The vertex map is kept between blocks to merge the vertices of their shared faces
+    Workspace workspace;
+
+    std::vector<double> vertices;
+    std::vector<size_t> polygons;
+    std::vector<double> attributes;
+};
+
+}
+
+#endif // _CHUNKED_H
@@ -0,0 +1,505 @@
+
+#ifndef _COMPACT_H
+#define _COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include "marchingcubes.h"
+
+namespace mc
+{
+
+/*
+    Compact quantized mesh format. The vertices are quantized relative to a grid (origin and
+    spacing): every coordinate is stored as the grid point below it plus a fraction of the
+    spacing with the given number of bits. A vertex is stored as the grid point (a delta from the
+    previous vertex), a mask of the axes with a nonzero fraction and those fractions only. The
+    vertices of marching cubes on the grid edges need a single fraction, and the ones on the face
+    and body diagonals of the tetrahedra two or three.
+    The triangles are stored as deltas between indices. Both are written with zigzag varints in
+    blocks of block_size vertices or triangles, which are decoded independently.
+
+    Layout (little-endian):
+        "MCQ1", uint32 bits, uint32 block_size, double origin[3], double spacing[3],
+        uint64 num_vertices, uint64 num_triangles,
+        vertex blocks, triangle blocks,
+        uint64 offsets of the vertex blocks and of the triangle blocks (plus the end of the last
+        one), uint64 position of the offsets
+*/
+struct CompactFormat
+{
+    std::array<double, 3> origin{{0.0, 0.0, 0.0}};
+    std::array<double, 3> spacing{{1.0, 1.0, 1.0}};
+
+    // Bits of the fractions, in [1, 24]
+    int bits = 16;
+
+    size_t block_size = 1 << 16;
+};
+
+namespace private_
+{
+
+const char compactMagic[4] = {'M', 'C', 'Q', '1'};
+
+// Size of the fixed header
+const size_t compactHeaderSize = 4 + 4 + 4 + 6 * 8 + 8 + 8;
+
+// Minimum size of an encoded vertex or triangle: three varints of at least one byte
+const size_t compactMinItemSize = 3;
+
+inline void putFixed(std::vector<unsigned char>& buffer, uint64_t value, int num_bytes)
+{
+    for (int b = 0; b < num_bytes; ++b)
+    {
+        buffer.push_back(static_cast<unsigned char>(value >> (8 * b)));
+    }
+}
+
+inline void putDouble(std::vector<unsigned char>& buffer, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    putFixed(buffer, bits, 8);
+}
+
+inline void putVarint(std::vector<unsigned char>& buffer, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<unsigned char>(value));
+}
+
+inline uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+/*
+    Reads the bytes of a block, checking that they stay within the block
+*/
+class ByteReader
+{
+public:
+
+    ByteReader(const unsigned char* begin, const unsigned char* end) : pos(begin), end(end) {}
+
+    uint64_t fixed(int num_bytes) {
+        if (end - pos < num_bytes)
+        {
+            throw std::runtime_error("truncated compact mesh");
+        }
+        uint64_t value = 0;
+        for (int b = 0; b < num_bytes; ++b)
+        {
+            value |= static_cast<uint64_t>(*pos++) << (8 * b);
+        }
+        return value;
+    }
+
+    double fixedDouble() {
+        uint64_t bits = fixed(8);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (pos == end)
+            {
+                throw std::runtime_error("truncated compact mesh");
+            }
+            unsigned char byte = *pos++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                return value;
+            }
+        }
+        throw std::runtime_error("invalid varint in compact mesh");
+    }
+
+private:
+
+    const unsigned char* pos;
+    const unsigned char* end;
+};
+
+}
+
+/*
+    Writes a mesh in the compact format. The blocks are encoded one at a time and streamed to the
+    file, so the memory used does not depend on the size of the mesh
+    @param vertices The coordinates of the vertices, three per vertex
+    @param polygons The indices of the triangles, three per triangle
+*/
+template<typename index_type>
+void write_compact(const char* filename, const double* vertices, size_t num_vertices,
+                   const index_type* polygons, size_t num_triangles, const CompactFormat& format)
+{
+    using namespace private_;
+
+    if (format.bits < 1 || format.bits > 24)
+    {
+        throw std::runtime_error("bits must be in [1, 24]");
+    }
+    if (format.block_size == 0 || format.block_size > 0xffffffffu)
+    {
+        throw std::runtime_error("block_size must be in [1, 2^32)");
+    }
+    for (int a = 0; a < 3; ++a)
+    {
+        if (!(format.spacing[a] > 0.0) || !std::isfinite(format.origin[a]))
+        {
+            throw std::runtime_error("the spacing must be positive and the origin finite");
+        }
+    }
+
+    // Out of range indices would give a file that read_compact rejects
+    for (size_t i = 0; i < 3 * num_triangles; ++i)
+    {
+        if (static_cast<uint64_t>(polygons[i]) >= num_vertices)
+        {
+            throw std::runtime_error("triangle references a vertex out of range");
+        }
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("cannot open the file for writing");
+    }
+
+    std::vector<unsigned char> buffer;
+    std::vector<uint64_t> offsets;
+    uint64_t position = 0;
+    auto flush = [&]() {
+        file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+        position += buffer.size();
+        buffer.clear();
+    };
+
+    for (char c : compactMagic)
+    {
+        buffer.push_back(static_cast<unsigned char>(c));
+    }
+    putFixed(buffer, format.bits, 4);
+    putFixed(buffer, format.block_size, 4);
+    for (int a = 0; a < 3; ++a)
+    {
+        putDouble(buffer, format.origin[a]);
+    }
+    for (int a = 0; a < 3; ++a)
+    {
+        putDouble(buffer, format.spacing[a]);
+    }
+    putFixed(buffer, num_vertices, 8);
+    putFixed(buffer, num_triangles, 8);
+    flush();
+
+    // Vertices, as quantized coordinates relative to the origin
+    const int64_t one = int64_t(1) << format.bits;
+    const double limit = std::ldexp(1.0, 58);
+    const int fraction_bytes = (format.bits + 7) / 8;
+    for (size_t first = 0; first < num_vertices; first += format.block_size)
+    {
+        offsets.push_back(position);
+        int64_t previous[3] = {0, 0, 0};
+        for (size_t v = first; v < std::min(num_vertices, first + format.block_size); ++v)
+        {
+            int64_t point[3];
+            int64_t fraction[3];
+            unsigned mask = 0;
+            for (int a = 0; a < 3; ++a)
+            {
+                double q = std::round((vertices[3 * v + a] - format.origin[a]) / format.spacing[a] * one);
+                if (!(std::abs(q) < limit))
+                {
+                    throw std::runtime_error("vertex out of the range of the compact format");
+                }
+                int64_t quantized = static_cast<int64_t>(q);
+                point[a] = quantized >= 0 ? quantized / one : -((one - 1 - quantized) / one);
+                fraction[a] = quantized - point[a] * one;
+                mask |= (fraction[a] != 0) << a;
+            }
+
+            putVarint(buffer, zigzag(point[2] - previous[2]) << 3 | mask);
+            putVarint(buffer, zigzag(point[0] - previous[0]));
+            putVarint(buffer, zigzag(point[1] - previous[1]));
+            for (int a = 0; a < 3; ++a)
+            {
+                if (mask & (1u << a))
+                {
+                    putFixed(buffer, fraction[a], fraction_bytes);
+                }
+                previous[a] = point[a];
+            }
+        }
+        flush();
+    }
+
+    // Triangles, as the delta of their first index from the previous triangle and the deltas of
+    // the other two from the first one
+    for (size_t first = 0; first < num_triangles; first += format.block_size)
+    {
+        offsets.push_back(position);
+        int64_t previous = 0;
+        for (size_t t = first; t < std::min(num_triangles, first + format.block_size); ++t)
+        {
+            int64_t a = static_cast<int64_t>(polygons[3 * t]);
+            putVarint(buffer, zigzag(a - previous));
+            putVarint(buffer, zigzag(static_cast<int64_t>(polygons[3 * t + 1]) - a));
+            putVarint(buffer, zigzag(static_cast<int64_t>(polygons[3 * t + 2]) - a));
+            previous = a;
+        }
+        flush();
+    }
+    offsets.push_back(position);
+
+    uint64_t table = position;
+    for (auto offset : offsets)
+    {
+        putFixed(buffer, offset, 8);
+    }
+    putFixed(buffer, table, 8);
+    flush();
+
+    if (!file)
+    {
+        throw std::runtime_error("error writing the file");
+    }
+}
+
+/*
+    Reads meshes in the compact format. The file is loaded and its header checked on
+    construction, then decode writes the mesh to buffers of the sizes given by num_vertices and
+    num_triangles
+*/
+class CompactReader
+{
+public:
+
+    /*
+        Constructor of the class
+        @param filename The file to read
+    */
+    CompactReader(const char* filename) {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file)
+        {
+            throw std::runtime_error("cannot open the file for reading");
+        }
+        data.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(data.data()), data.size());
+        if (!file)
+        {
+            throw std::runtime_error("error reading the file");
+        }
+
+        if (data.size() < private_::compactHeaderSize + 16 ||
+            !std::equal(private_::compactMagic, private_::compactMagic + 4, data.begin()))
+        {
+            throw std::runtime_error("not a compact mesh file");
+        }
+
+        private_::ByteReader header(data.data() + 4, data.data() + data.size());
+        format.bits = static_cast<int>(header.fixed(4));
+        format.block_size = header.fixed(4);
+        for (int a = 0; a < 3; ++a)
+        {
+            format.origin[a] = header.fixedDouble();
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+            format.spacing[a] = header.fixedDouble();
+        }
+        vertex_count = header.fixed(8);
+        triangle_count = header.fixed(8);
+        if (format.bits < 1 || format.bits > 24 || format.block_size == 0)
+        {
+            throw std::runtime_error("invalid compact mesh header");
+        }
+
+        // Every vertex and triangle takes some bytes, so the counts cannot exceed the size of the
+        // file. This also keeps the sizes of the output buffers from overflowing
+        if (vertex_count > data.size() / private_::compactMinItemSize ||
+            triangle_count > data.size() / private_::compactMinItemSize)
+        {
+            throw std::runtime_error("invalid compact mesh header");
+        }
+
+        // Offsets of the blocks
+        size_t num_blocks = blockCount(vertex_count) + blockCount(triangle_count);
+        private_::ByteReader footer(data.data() + data.size() - 8, data.data() + data.size());
+        uint64_t table = footer.fixed(8);
+        if (table < private_::compactHeaderSize || table > data.size() - 8 ||
+            (data.size() - 8 - table) / 8 != num_blocks + 1)
+        {
+            throw std::runtime_error("invalid compact mesh block table");
+        }
+        private_::ByteReader reader(data.data() + table, data.data() + data.size() - 8);
+        offsets.resize(num_blocks + 1);
+        for (auto& offset : offsets)
+        {
+            offset = reader.fixed(8);
+        }
+        size_t vertex_blocks = blockCount(vertex_count);
+        for (size_t b = 0; b < num_blocks; ++b)
+        {
+            if (offsets[b] < private_::compactHeaderSize || offsets[b] > offsets[b + 1] || offsets[b + 1] > table)
+            {
+                throw std::runtime_error("invalid compact mesh block table");
+            }
+
+            // The block must have room for its vertices or triangles
+            size_t count = b < vertex_blocks ? vertex_count : triangle_count;
+            size_t first = (b < vertex_blocks ? b : b - vertex_blocks) * format.block_size;
+            size_t items = std::min(count - first, format.block_size);
+            if ((offsets[b + 1] - offsets[b]) / private_::compactMinItemSize < items)
+            {
+                throw std::runtime_error("invalid compact mesh block table");
+            }
+        }
+    }
+
+    const CompactFormat& get_format() const {
+        return format;
+    }
+
+    size_t num_vertices() const {
+        return vertex_count;
+    }
+
+    size_t num_triangles() const {
+        return triangle_count;
+    }
+
+    /*
+        Decodes the mesh splitting its blocks among num_threads threads
+        @param vertices Buffer of 3 * num_vertices() coordinates
+        @param polygons Buffer of 3 * num_triangles() indices
+    */
+    template<typename index_type>
+    void decode(double* vertices, index_type* polygons, int num_threads) const {
+        size_t vertex_blocks = blockCount(vertex_count);
+        int num_blocks = static_cast<int>(offsets.size() - 1);
+
+        // Exceptions cannot leave the threads: keep the first one of every range
+        std::vector<std::exception_ptr> errors(std::max(1, std::min(num_threads, num_blocks)));
+        private_::parallelRanges(num_blocks, num_threads, [&](int first, int last, int range) {
+            try
+            {
+                for (int b = first; b < last; ++b)
+                {
+                    if (static_cast<size_t>(b) < vertex_blocks)
+                    {
+                        decodeVertices(b, vertices);
+                    }
+                    else
+                    {
+                        decodeTriangles(b - vertex_blocks, polygons);
+                    }
+                }
+            }
+            catch (...)
+            {
+                errors[range] = std::current_exception();
+            }
+        });
+        for (auto& error : errors)
+        {
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+private:
+
+    std::vector<unsigned char> data;
+    CompactFormat format;
+    size_t vertex_count;
+    size_t triangle_count;
+    std::vector<uint64_t> offsets;
+
+    size_t blockCount(size_t count) const {
+        return count / format.block_size + (count % format.block_size != 0);
+    }
+
+    private_::ByteReader block(size_t b) const {
+        return private_::ByteReader(data.data() + offsets[b], data.data() + offsets[b + 1]);
+    }
+
+    void decodeVertices(size_t b, double* vertices) const {
+        using private_::unzigzag;
+
+        private_::ByteReader reader = block(b);
+        const double one = std::ldexp(1.0, format.bits);
+        const int fraction_bytes = (format.bits + 7) / 8;
+        int64_t point[3] = {0, 0, 0};
+        size_t first = b * format.block_size;
+        for (size_t v = first; v < std::min(vertex_count, first + format.block_size); ++v)
+        {
+            uint64_t key = reader.varint();
+            unsigned mask = key & 7;
+            point[2] += unzigzag(key >> 3);
+            point[0] += unzigzag(reader.varint());
+            point[1] += unzigzag(reader.varint());
+            for (int a = 0; a < 3; ++a)
+            {
+                double fraction = mask & (1u << a) ? reader.fixed(fraction_bytes) / one : 0.0;
+                vertices[3 * v + a] = format.origin[a] + (point[a] + fraction) * format.spacing[a];
+            }
+        }
+    }
+
+    template<typename index_type>
+    void decodeTriangles(size_t b, index_type* polygons) const {
+        using private_::unzigzag;
+
+        private_::ByteReader reader = block(b + blockCount(vertex_count));
+        int64_t previous = 0;
+        size_t first = b * format.block_size;
+        for (size_t t = first; t < std::min(triangle_count, first + format.block_size); ++t)
+        {
+            int64_t index[3];
+            index[0] = previous + unzigzag(reader.varint());
+            index[1] = index[0] + unzigzag(reader.varint());
+            index[2] = index[0] + unzigzag(reader.varint());
+            for (int c = 0; c < 3; ++c)
+            {
+                if (index[c] < 0 || static_cast<uint64_t>(index[c]) >= vertex_count)
+                {
+                    throw std::runtime_error("compact mesh triangle references a vertex out of range");
+                }
+                polygons[3 * t + c] = static_cast<index_type>(index[c]);
+            }
+            previous = index[0];
+        }
+    }
+};
+
+}
+
+#endif // _COMPACT_H
@@ -0,0 +1,645 @@
+
+#include "decimation.h"
+
+#include "marchingcubes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <thread>
+
+namespace mc
+{
+
+namespace private_
+{
+
+/*
+	Symmetric 4x4 matrix of a quadric error metric. Only the upper triangle is stored:
+	a2 ab ac ad b2 bc bd c2 cd d2
+*/
+struct Quadric
+{
+	double q[10];
+
+	Quadric() {
+		std::fill(q, q + 10, 0.0);
+	}
+
+	/*
+		Quadric of the squared distance to the plane ax + by + cz + d = 0, where (a, b, c) is a unit
+		vector, scaled by the given weight
+	*/
+	Quadric(double a, double b, double c, double d, double weight) {
+		q[0] = weight * a * a; q[1] = weight * a * b; q[2] = weight * a * c; q[3] = weight * a * d;
+		q[4] = weight * b * b; q[5] = weight * b * c; q[6] = weight * b * d;
+		q[7] = weight * c * c; q[8] = weight * c * d;
+		q[9] = weight * d * d;
+	}
+
+	Quadric& operator+=(const Quadric& other) {
+		for (int i = 0; i < 10; ++i)
+		{
+			q[i] += other.q[i];
+		}
+		return *this;
+	}
+
+	/*
+		Evaluates the error of the quadric at the given point
+	*/
+	double error(double x, double y, double z) const {
+		return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+		     + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+		     + q[7] * z * z + 2 * q[8] * z
+		     + q[9];
+	}
+
+	/*
+		Computes the point that minimizes the error of the quadric
+		@return false if the problem is ill-conditioned and the point could not be computed
+	*/
+	bool optimum(double& x, double& y, double& z) const {
+		// Solve A p = -b by Cramer's rule
+		double c00 = q[4] * q[7] - q[5] * q[5];
+		double c01 = q[2] * q[5] - q[1] * q[7];
+		double c02 = q[1] * q[5] - q[2] * q[4];
+		double det = q[0] * c00 + q[1] * c01 + q[2] * c02;
+
+		double scale = q[0] + q[4] + q[7];
+		if (std::abs(det) <= 1e-9 * scale * scale * scale)
+		{
+			return false;
+		}
+
+		double c11 = q[0] * q[7] - q[2] * q[2];
+		double c12 = q[1] * q[2] - q[0] * q[5];
+		double c22 = q[0] * q[4] - q[1] * q[1];
+
+		x = -(c00 * q[3] + c01 * q[6] + c02 * q[8]) / det;
+		y = -(c01 * q[3] + c11 * q[6] + c12 * q[8]) / det;
+		z = -(c02 * q[3] + c12 * q[6] + c22 * q[8]) / det;
+		return true;
+	}
+};
+
+/*
+	Candidate edge collapse. The entry is stale if any of the vertices changed after it was pushed
+*/
+struct Collapse
+{
+	double cost;
+	size_t u, v;
+	unsigned stamp_u, stamp_v;
+	double x, y, z;
+
+	bool operator>(const Collapse& other) const {
+		return cost > other.cost;
+	}
+};
+
+/*
+	Edge collapse simplification of a mesh. Every vertex belongs to a region, and only edges
+	between vertices of the same region are collapsed, so regions can be simplified concurrently
+	as long as their faces and free vertices are disjoint
+*/
+class Decimator
+{
+public:
+
+	// Region of the vertices that cannot move (shared by faces of several regions)
+	static const int LOCKED = -1;
+
+	// Region that allows every vertex to move
+	static const int ANY = -2;
+
+	std::vector<double>& vertices;
+	std::vector<size_t>& polygons;
+
+	std::vector<Quadric> quadrics;
+	std::vector<std::vector<size_t> > vertex_faces;
+	std::vector<unsigned> stamps;
+	std::vector<char> vertex_removed;
+	std::vector<char> face_removed;
+
+	// Region of each vertex and of each face
+	std::vector<int> vertex_region;
+	std::vector<int> face_region;
+
+	Decimator(std::vector<double>& vertices, std::vector<size_t>& polygons)
+		: vertices(vertices), polygons(polygons)
+	{
+		size_t num_vertices = vertices.size() / 3;
+		size_t num_faces = polygons.size() / 3;
+
+		quadrics.resize(num_vertices);
+		vertex_faces.resize(num_vertices);
+		stamps.resize(num_vertices, 0);
+		vertex_removed.resize(num_vertices, 0);
+		face_removed.resize(num_faces, 0);
+		vertex_region.resize(num_vertices, 0);
+		face_region.resize(num_faces, 0);
+
+		// Plane quadrics of the faces. Collapsed faces are dropped beforehand
+		for (size_t f = 0; f < num_faces; ++f)
+		{
+			size_t a = polygons[3 * f], b = polygons[3 * f + 1], c = polygons[3 * f + 2];
+			if (a == b || b == c || c == a)
+			{
+				face_removed[f] = 1;
+				continue;
+			}
+
+			double n[3];
+			if (!faceNormal(f, n))
+			{
+				for (int i = 0; i < 3; ++i)
+				{
+					vertex_faces[polygons[3 * f + i]].push_back(f);
+				}
+				continue;
+			}
+
+			const double* p = &vertices[3 * polygons[3 * f]];
+			Quadric Q(n[0], n[1], n[2], -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]), 1.0);
+			for (int i = 0; i < 3; ++i)
+			{
+				quadrics[polygons[3 * f + i]] += Q;
+				vertex_faces[polygons[3 * f + i]].push_back(f);
+			}
+		}
+
+		addBorderQuadrics();
+	}
+
+	/*
+		Computes the unit normal of face f. If point is not NULL, it replaces the position of
+		vertex moved
+		@return false if the face is degenerate
+	*/
+	bool faceNormal(size_t f, double* n, size_t moved = 0, const double* point = NULL) const {
+		double p[3][3];
+		for (int i = 0; i < 3; ++i)
+		{
+			size_t index = polygons[3 * f + i];
+			const double* src = (point != NULL && index == moved) ? point : &vertices[3 * index];
+			std::copy(src, src + 3, p[i]);
+		}
+
+		double e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+		double e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+		double norm = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (norm == 0.0)
+		{
+			return false;
+		}
+
+		n[0] /= norm; n[1] /= norm; n[2] /= norm;
+		return true;
+	}
+
+	/*
+		Adds to the vertices of the border edges (used by a single face) the quadric of the plane
+		orthogonal to the face through the edge, so that the border is kept in place
+	*/
+	void addBorderQuadrics() {
+		const double border_weight = 1000.0;
+
+		// Sort the undirected edges to find the ones that appear only once
+		std::vector<std::pair<std::pair<size_t, size_t>, size_t> > edges;
+		edges.reserve(polygons.size());
+		for (size_t f = 0; f < polygons.size() / 3; ++f)
+		{
+			if (face_removed[f])
+			{
+				continue;
+			}
+			for (int i = 0; i < 3; ++i)
+			{
+				size_t a = polygons[3 * f + i], b = polygons[3 * f + (i + 1) % 3];
+				edges.push_back(std::make_pair(std::make_pair(std::min(a, b), std::max(a, b)), f));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+
+		for (size_t e = 0; e < edges.size(); ++e)
+		{
+			bool shared = (e > 0 && edges[e - 1].first == edges[e].first) ||
+			              (e + 1 < edges.size() && edges[e + 1].first == edges[e].first);
+			if (shared)
+			{
+				continue;
+			}
+
+			double n[3];
+			if (!faceNormal(edges[e].second, n))
+			{
+				continue;
+			}
+
+			size_t a = edges[e].first.first, b = edges[e].first.second;
+			const double* pa = &vertices[3 * a];
+			const double* pb = &vertices[3 * b];
+			double d[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+			double m[3] = {d[1] * n[2] - d[2] * n[1], d[2] * n[0] - d[0] * n[2], d[0] * n[1] - d[1] * n[0]};
+			double norm = std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+			if (norm == 0.0)
+			{
+				continue;
+			}
+
+			m[0] /= norm; m[1] /= norm; m[2] /= norm;
+			Quadric Q(m[0], m[1], m[2], -(m[0] * pa[0] + m[1] * pa[1] + m[2] * pa[2]), border_weight);
+			quadrics[a] += Q;
+			quadrics[b] += Q;
+		}
+	}
+
+	/*
+		Splits the mesh into num_regions slabs along its longest axis. The faces with vertices
+		in different slabs are left to a later pass, and their vertices are locked
+	*/
+	void partition(int num_regions) {
+		size_t num_vertices = vertices.size() / 3;
+		if (num_vertices == 0)
+		{
+			return;
+		}
+
+		// Longest axis of the bounding box
+		double lower[3], upper[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			lower[c] = upper[c] = vertices[c];
+		}
+		for (size_t i = 0; i < num_vertices; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				lower[c] = std::min(lower[c], vertices[3 * i + c]);
+				upper[c] = std::max(upper[c], vertices[3 * i + c]);
+			}
+		}
+		int axis = 0;
+		for (int c = 1; c < 3; ++c)
+		{
+			if (upper[c] - lower[c] > upper[axis] - lower[axis])
+			{
+				axis = c;
+			}
+		}
+
+		double extent = upper[axis] - lower[axis];
+		for (size_t i = 0; i < num_vertices; ++i)
+		{
+			int region = extent > 0 ? static_cast<int>((vertices[3 * i + axis] - lower[axis]) / extent * num_regions) : 0;
+			vertex_region[i] = std::min(region, num_regions - 1);
+		}
+
+		for (size_t f = 0; f < face_region.size(); ++f)
+		{
+			int r0 = vertex_region[polygons[3 * f]];
+			int r1 = vertex_region[polygons[3 * f + 1]];
+			int r2 = vertex_region[polygons[3 * f + 2]];
+			face_region[f] = (r0 == r1 && r1 == r2) ? r0 : LOCKED;
+		}
+
+		// A vertex is free only if all its faces belong to its region
+		for (size_t i = 0; i < num_vertices; ++i)
+		{
+			for (auto f : vertex_faces[i])
+			{
+				if (face_region[f] != vertex_region[i])
+				{
+					vertex_region[i] = LOCKED;
+					break;
+				}
+			}
+		}
+	}
+
+	/*
+		Indicates whether the vertex can be moved when simplifying the given region
+	*/
+	bool isFree(size_t v, int region) const {
+		return region == ANY || vertex_region[v] == region;
+	}
+
+	/*
+		Computes the cost and the target point of collapsing the edge (u, v)
+	*/
+	Collapse evaluate(size_t u, size_t v) const {
+		Quadric Q = quadrics[u];
+		Q += quadrics[v];
+
+		Collapse c;
+		c.u = u; c.v = v;
+		c.stamp_u = stamps[u]; c.stamp_v = stamps[v];
+
+		if (Q.optimum(c.x, c.y, c.z))
+		{
+			c.cost = Q.error(c.x, c.y, c.z);
+		}
+		else
+		{
+			// Best among the end points and the midpoint
+			const double* pu = &vertices[3 * u];
+			const double* pv = &vertices[3 * v];
+			double candidates[3][3] = {{pu[0], pu[1], pu[2]}, {pv[0], pv[1], pv[2]},
+			                           {(pu[0] + pv[0]) / 2, (pu[1] + pv[1]) / 2, (pu[2] + pv[2]) / 2}};
+			c.cost = -1.0;
+			for (auto& p : candidates)
+			{
+				double error = Q.error(p[0], p[1], p[2]);
+				if (c.cost < 0.0 || error < c.cost)
+				{
+					c.cost = error;
+					c.x = p[0]; c.y = p[1]; c.z = p[2];
+				}
+			}
+		}
+
+		// Rounding errors may give slightly negative values
+		c.cost = std::max(c.cost, 0.0);
+		return c;
+	}
+
+	/*
+		Collects the vertices connected to v through alive faces
+	*/
+	void neighbors(size_t v, std::vector<size_t>& result) const {
+		result.clear();
+		for (auto f : vertex_faces[v])
+		{
+			if (face_removed[f])
+			{
+				continue;
+			}
+			for (int i = 0; i < 3; ++i)
+			{
+				if (polygons[3 * f + i] != v)
+				{
+					result.push_back(polygons[3 * f + i]);
+				}
+			}
+		}
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+	}
+
+	/*
+		Checks whether collapsing edge (u, v) into the point of c keeps the mesh manifold and
+		does not flip any face
+	*/
+	bool isValid(const Collapse& c, std::vector<size_t>& nu, std::vector<size_t>& nv) const {
+		// Link condition: the common neighbors must be the opposite vertices of the shared faces
+		neighbors(c.u, nu);
+		neighbors(c.v, nv);
+		size_t common = 0;
+		for (size_t i = 0, j = 0; i < nu.size() && j < nv.size();)
+		{
+			if (nu[i] < nv[j])
+			{
+				++i;
+			}
+			else if (nu[i] > nv[j])
+			{
+				++j;
+			}
+			else
+			{
+				++common; ++i; ++j;
+			}
+		}
+
+		size_t shared_faces = 0;
+		for (auto f : vertex_faces[c.u])
+		{
+			if (!face_removed[f] && hasVertex(f, c.v))
+			{
+				++shared_faces;
+			}
+		}
+		if (shared_faces == 0 || common != shared_faces)
+		{
+			return false;
+		}
+
+		// The faces that survive the collapse must keep their orientation
+		const size_t ends[2] = {c.u, c.v};
+		const double point[3] = {c.x, c.y, c.z};
+		for (auto w : ends)
+		{
+			for (auto f : vertex_faces[w])
+			{
+				if (face_removed[f] || (hasVertex(f, c.u) && hasVertex(f, c.v)))
+				{
+					continue;
+				}
+
+				double before[3], after[3];
+				if (!faceNormal(f, before))
+				{
+					continue;
+				}
+				if (!faceNormal(f, after, w, point) ||
+				    before[0] * after[0] + before[1] * after[1] + before[2] * after[2] < 0.2)
+				{
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	bool hasVertex(size_t f, size_t v) const {
+		return polygons[3 * f] == v || polygons[3 * f + 1] == v || polygons[3 * f + 2] == v;
+	}
+
+	/*
+		Collapses v into u, moving u to the point of c
+		@return The number of removed faces
+	*/
+	size_t collapse(const Collapse& c) {
+		size_t u = c.u, v = c.v;
+		size_t removed = 0;
+
+		vertices[3 * u] = c.x;
+		vertices[3 * u + 1] = c.y;
+		vertices[3 * u + 2] = c.z;
+		quadrics[u] += quadrics[v];
+		vertex_removed[v] = 1;
+		++stamps[u];
+		++stamps[v];
+
+		for (auto f : vertex_faces[v])
+		{
+			if (face_removed[f])
+			{
+				continue;
+			}
+
+			if (hasVertex(f, u))
+			{
+				face_removed[f] = 1;
+				++removed;
+				continue;
+			}
+
+			for (int i = 0; i < 3; ++i)
+			{
+				if (polygons[3 * f + i] == v)
+				{
+					polygons[3 * f + i] = u;
+				}
+			}
+			vertex_faces[u].push_back(f);
+		}
+		vertex_faces[v].clear();
+
+		// Forget the removed faces of u
+		auto& faces_u = vertex_faces[u];
+		faces_u.erase(std::remove_if(faces_u.begin(), faces_u.end(),
+		                             [&](size_t f) -> bool { return face_removed[f] != 0; }),
+		              faces_u.end());
+
+		return removed;
+	}
+
+	/*
+		Simplifies the faces of the given region until it has at most target_faces faces or the
+		cost of the next collapse is larger than max_error
+		@param region The region to simplify, or ANY to simplify the whole mesh
+	*/
+	void simplify(int region, size_t target_faces, double max_error) {
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse> > heap;
+		size_t alive = 0;
+
+		for (size_t f = 0; f < face_region.size(); ++f)
+		{
+			if (face_removed[f] || (region != ANY && face_region[f] != region))
+			{
+				continue;
+			}
+
+			++alive;
+			for (int i = 0; i < 3; ++i)
+			{
+				size_t a = polygons[3 * f + i], b = polygons[3 * f + (i + 1) % 3];
+				if (a < b && isFree(a, region) && isFree(b, region))
+				{
+					heap.push(evaluate(a, b));
+				}
+			}
+		}
+
+		std::vector<size_t> nu, nv;
+		while (alive > target_faces && !heap.empty())
+		{
+			Collapse c = heap.top();
+			heap.pop();
+
+			if (c.cost > max_error)
+			{
+				break;
+			}
+
+			if (vertex_removed[c.u] || vertex_removed[c.v] ||
+			    stamps[c.u] != c.stamp_u || stamps[c.v] != c.stamp_v)
+			{
+				continue;
+			}
+
+			if (!isValid(c, nu, nv))
+			{
+				continue;
+			}
+
+			alive -= collapse(c);
+
+			// Update the candidates around the new vertex
+			neighbors(c.u, nu);
+			for (auto w : nu)
+			{
+				if (isFree(w, region))
+				{
+					heap.push(evaluate(c.u, w));
+				}
+			}
+		}
+	}
+};
+
+}
+
+void decimate(std::vector<double>& vertices, std::vector<size_t>& polygons,
+              size_t target_triangles, double max_error, int num_threads)
+{
+	using namespace private_;
+
+	size_t num_faces = polygons.size() / 3;
+	if (num_faces <= target_triangles)
+	{
+		return;
+	}
+
+	if (num_threads <= 0)
+	{
+		num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	}
+
+	Decimator decimator(vertices, polygons);
+
+	// Parallel pass over the slabs. Each slab gets its share of the target
+	if (num_threads > 1)
+	{
+		decimator.partition(num_threads);
+
+		std::vector<size_t> region_faces(num_threads, 0);
+		for (auto r : decimator.face_region)
+		{
+			if (r >= 0)
+			{
+				++region_faces[r];
+			}
+		}
+
+		std::vector<std::thread> workers;
+		for (int r = 0; r < num_threads; ++r)
+		{
+			size_t target = static_cast<size_t>(static_cast<double>(target_triangles) * region_faces[r] / num_faces);
+			workers.push_back(std::thread(&Decimator::simplify, &decimator, r, target, max_error));
+		}
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	// Sequential pass over the whole mesh, which also simplifies the seams between slabs
+	decimator.simplify(Decimator::ANY, target_triangles, max_error);
+
+	// Keep the alive faces and drop the unreferenced vertices
+	size_t kept = 0;
+	for (size_t f = 0; f < num_faces; ++f)
+	{
+		if (decimator.face_removed[f])
+		{
+			continue;
+		}
+		std::copy(polygons.begin() + 3 * f, polygons.begin() + 3 * (f + 1), polygons.begin() + 3 * kept);
+		++kept;
+	}
+	polygons.resize(3 * kept);
+
+	std::vector<double> attributes;
+	compact_vertices(vertices, polygons, attributes, 0);
+}
+
+}
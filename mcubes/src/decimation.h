@@ -0,0 +1,30 @@
+
+#ifndef _DECIMATION_H
+#define _DECIMATION_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace mc
+{
+
+/*
+    Simplifies a triangle mesh with quadric error metric edge collapses (Garland & Heckbert).
+    Edges are collapsed in order of increasing error until the mesh has at most target_triangles
+    triangles or the error of the cheapest collapse exceeds max_error. The error of a vertex is
+    the sum of its squared distances to the planes of the original faces merged into it.
+    Collapses that flip a face or break the manifoldness of the mesh are rejected, and the border
+    of open meshes is preserved.
+
+    The mesh is partitioned into num_threads slabs along its longest axis which are simplified in
+    parallel keeping the vertices shared between slabs fixed. A final sequential pass simplifies
+    the seams. If num_threads is not positive, the number of hardware threads is used.
+
+    The unreferenced vertices are removed from the result.
+*/
+void decimate(std::vector<double>& vertices, std::vector<size_t>& polygons,
+              size_t target_triangles, double max_error, int num_threads);
+
+}
+
+#endif // _DECIMATION_H
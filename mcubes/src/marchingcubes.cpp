@@ -1,5 +1,10 @@
 
 #include "marchingcubes.h"
+#include "UnionFind.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
 
 namespace mc
 {
@@ -7,12 +12,60 @@ namespace mc
 namespace private_
 {
 
+const int cellCorners[8][3] = {
+	{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0}, {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}
+};
+
+const int cellTetrahedra[6][4] = {
+	{0, 1, 3, 5}, {1, 2, 3, 5}, {0, 3, 4, 5}, {2, 3, 5, 6}, {3, 4, 5, 7}, {3, 5, 6, 7}
+};
+
+const int cellFiveTetrahedra[2][5][4] = {
+	{{0, 2, 5, 7}, {1, 0, 2, 5}, {3, 0, 2, 7}, {4, 0, 5, 7}, {6, 2, 5, 7}},
+	{{1, 3, 4, 6}, {0, 1, 3, 4}, {2, 1, 3, 6}, {5, 1, 4, 6}, {7, 3, 4, 6}}
+};
+
+const int edgeDirections[10][3] = {
+	{1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {1, 0, 1}, {1, -1, 0}, {0, 1, -1}, {1, -1, 1},
+	{1, 1, 0}, {1, 0, -1}, {0, 1, 1}
+};
+
 /*
-	Returns the parameter t such that it gives the linear interpolation value f between f1 and f2
+	Returns the parameter t such that it gives the linear interpolation value f between f1 and f2.
+	Parameters closer than snap to either end of the edge are snapped to that end
 */
-double inverseLinearInterpolation(double f, double f1, double f2)
+double inverseLinearInterpolation(double f, double f1, double f2, double snap)
 {
-	return (f - f1) / (f2 - f1);
+	double t = (f - f1) / (f2 - f1);
+	if (t < snap)
+	{
+		return 0.0;
+	}
+	if (t > 1.0 - snap)
+	{
+		return 1.0;
+	}
+	return t;
+}
+
+/*
+	Returns the vertex of the tetrahedron whose value is the farthest from the isovalue. Such
+	vertex is never on the plane of the triangles built in the tetrahedron, even when some of
+	their vertices have been snapped to the corners, so it can be used to orient them
+*/
+const Vector3& orientationReference(const Vector3& V0, const Vector3& V1, const Vector3& V2, const Vector3& V3,
+                                    double isovalue)
+{
+	const Vector3* reference = &V0;
+	const Vector3* candidates[3] = {&V1, &V2, &V3};
+	for (auto candidate : candidates)
+	{
+		if (std::abs(candidate->info - isovalue) > std::abs(reference->info - isovalue))
+		{
+			reference = candidate;
+		}
+	}
+	return *reference;
 }
 
 /*
@@ -23,30 +76,36 @@ double inverseLinearInterpolation(double f, double f1, double f2)
 	@param V2 The next next vertex in counter clockwise order
 	@param V3 The vertex that is not on the plane where V0, V1 and V2 are
 	@param isovalue The isovalue to be considered for inverse interpolation
-	@return The pointer to the generated triangle
+	@param snap Relative distance to the ends of the edges under which the vertices are snapped to them
+	@param triangles The vector where the triangle is appended, unless it is degenerate. Triangles
+	collapsed by snapping are kept, so the cleanup removes and counts them
 */
-Triangle* buildTriangle(Vector3* V0, Vector3* V1, Vector3* V2, Vector3* V3, double isovalue)
+void buildTriangle(const Vector3& V0, const Vector3& V1, const Vector3& V2, const Vector3& V3,
+                   double isovalue, double snap, std::vector<Triangle>& triangles)
 {
 	// Get the t parameters for the intersected values in the edges
-	double t01 = inverseLinearInterpolation(isovalue, V0->info, V1->info);
-	double t02 = inverseLinearInterpolation(isovalue, V0->info, V2->info);
-	double t03 = inverseLinearInterpolation(isovalue, V0->info, V3->info);
+	double t01 = inverseLinearInterpolation(isovalue, V0.info, V1.info, snap);
+	double t02 = inverseLinearInterpolation(isovalue, V0.info, V2.info, snap);
+	double t03 = inverseLinearInterpolation(isovalue, V0.info, V3.info, snap);
 
 	// Interpolate values and get the triangle vertices
-	Vector3* T0 = V0->interpolate(t01, V1);
-	Vector3* T1 = V0->interpolate(t03, V3);
-	Vector3* T2 = V0->interpolate(t02, V2);
+	Vector3 T0 = V0.interpolate(t01, V1);
+	Vector3 T1 = V0.interpolate(t03, V3);
+	Vector3 T2 = V0.interpolate(t02, V2);
 
 	// Generate the triangle
-	Triangle* T = new Triangle(T0, T1, T2);
-    if ((V0->info > isovalue) ^ T->isCCW(V0)) {
-        T->v1 = T2;
-        T->v2 = T1;
+	const Vector3& R = orientationReference(V0, V1, V2, V3, isovalue);
+	Triangle T(T0, T1, T2);
+    if ((R.info > isovalue) ^ T.isCCW(R)) {
+        std::swap(T.v1, T.v2);
     }
 
 	// If it happens to be a degenerate triangle (all the vertices are in the same point) then
-	// return NULL, Otherwise return the triangle
-	return (T->isPoint()) ? NULL : T;
+	// discard it. Without snapping that only happens when V0 is on the isosurface
+	if (!T.isPoint() || (snap > 0.0 && V0.info != isovalue))
+	{
+		triangles.push_back(std::move(T));
+	}
 }
 
 /*
@@ -57,49 +116,47 @@ Triangle* buildTriangle(Vector3* V0, Vector3* V1, Vector3* V2, Vector3* V3, doub
 	@param V2 The next next vertex in counter clockwise order
 	@param V3 The vertex that is not on the plane where V0, V1 and V2 are
 	@param isovalue The isovalue to be considered for inverse interpolation
-	@return The pointer to a vector with the generated triangles
+	@param snap Relative distance to the ends of the edges under which the vertices are snapped to them
+	@param triangles The vector where the non-degenerate triangles are appended. Triangles
+	collapsed by snapping are kept, so the cleanup removes and counts them
 */
-std::vector<Triangle*>* buildTriangles(Vector3* V0, Vector3* V1, Vector3* V2, Vector3* V3, double isovalue)
+void buildTriangles(const Vector3& V0, const Vector3& V1, const Vector3& V2, const Vector3& V3,
+                    double isovalue, double snap, std::vector<Triangle>& triangles)
 {
 	// Get the t parameters for the intersected values in the edges
-	double t02 = inverseLinearInterpolation(isovalue, V0->info, V2->info);
-	double t03 = inverseLinearInterpolation(isovalue, V0->info, V3->info);
-	double t12 = inverseLinearInterpolation(isovalue, V1->info, V2->info);
-	double t13 = inverseLinearInterpolation(isovalue, V1->info, V3->info);
-
-	Vector3* T0 = V0->interpolate(t02, V2);
-	Vector3* T1 = V1->interpolate(t12, V2);
-	Vector3* T2 = V1->interpolate(t13, V3);
-	Vector3* T3 = V0->interpolate(t03, V3);
-
-	// Generate the triangles and store them in a vector
-	Triangle* triangle1 = new Triangle(T0, T1, T2);
-    if ((V0->info > isovalue) ^ triangle1->isCCW(V0)) {
-        triangle1->v1 = T2;
-        triangle1->v2 = T1;
+	double t02 = inverseLinearInterpolation(isovalue, V0.info, V2.info, snap);
+	double t03 = inverseLinearInterpolation(isovalue, V0.info, V3.info, snap);
+	double t12 = inverseLinearInterpolation(isovalue, V1.info, V2.info, snap);
+	double t13 = inverseLinearInterpolation(isovalue, V1.info, V3.info, snap);
+
+	Vector3 T0 = V0.interpolate(t02, V2);
+	Vector3 T1 = V1.interpolate(t12, V2);
+	Vector3 T2 = V1.interpolate(t13, V3);
+	Vector3 T3 = V0.interpolate(t03, V3);
+
+	// Generate the triangles
+	const Vector3& R = orientationReference(V0, V1, V2, V3, isovalue);
+	Triangle triangle1(T0, T1, T2);
+    if ((R.info > isovalue) ^ triangle1.isCCW(R)) {
+        std::swap(triangle1.v1, triangle1.v2);
     }
 
-	Triangle* triangle2 = new Triangle(T2, T3, T0);
-    if ((V0->info > isovalue) ^ triangle2->isCCW(V0)) {
-        triangle2->v1 = T0;
-        triangle2->v2 = T3;
+	Triangle triangle2(T2, T3, T0);
+    if ((R.info > isovalue) ^ triangle2.isCCW(R)) {
+        std::swap(triangle2.v1, triangle2.v2);
     }
 
-	std::vector<Triangle*>* triangles = new std::vector<Triangle*>();
-
-	// If the triangles are not degenerate (their vertices are the same point) then add them to the triangles vector
-	if (!triangle1->isPoint())
+	// If the triangles are not degenerate (their vertices are the same point) then add them to the triangles vector.
+	// Their vertices are on different edges, so only snapping can collapse them
+	if (snap > 0.0 || !triangle1.isPoint())
 	{
-		triangles->push_back(triangle1);
+		triangles.push_back(std::move(triangle1));
 	}
 
-	if (!triangle2->isPoint())
+	if (snap > 0.0 || !triangle2.isPoint())
 	{
-		triangles->push_back(triangle2);
+		triangles.push_back(std::move(triangle2));
 	}
-
-	// Returns the triangles
-	return triangles;
 }
 
 /*
@@ -109,18 +166,17 @@ std::vector<Triangle*>* buildTriangles(Vector3* V0, Vector3* V1, Vector3* V2, Ve
 	@param V2
 	@param V3
 	@param isovalue
-	@return A pointer to a vector with the generated triangles
+	@param snap
+	@param triangles The vector where the generated triangles are appended
 */
-std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, Vector3* V3, double isovalue)
+void marchTetrahedra(const Vector3& V0, const Vector3& V1, const Vector3& V2, const Vector3& V3,
+                     double isovalue, double snap, std::vector<Triangle>& triangles)
 {
-	// Initialize the vector where the triangles will be stored
-	std::vector<Triangle*>* triangles = new std::vector<Triangle*>();
-
 	// Define the signs of each vertex of the tetrahedron
-	int s0 = (V0->info > isovalue) ? 1 : 0;
-	int s1 = (V1->info > isovalue) ? 1 : 0;
-	int s2 = (V2->info > isovalue) ? 1 : 0;
-	int s3 = (V3->info > isovalue) ? 1 : 0;
+	int s0 = (V0.info > isovalue) ? 1 : 0;
+	int s1 = (V1.info > isovalue) ? 1 : 0;
+	int s2 = (V2.info > isovalue) ? 1 : 0;
+	int s3 = (V3.info > isovalue) ? 1 : 0;
 
 	// Process each case
 	if (s0 == 0 && s1 == 0 && s2 == 0 && s3 == 0)
@@ -133,13 +189,8 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 		// One positive vertex, all others negative => One triangle
 		// Vertices are in edges 0-1, 0-2 and 0-3
 
-		// Generate the triangle and add it only if it is not NULL
-		// NOTE: A triangle is NULL if it is a degenerated triangle
-		Triangle* triangle = buildTriangle(V0, V1, V2, V3, isovalue);
-		if (triangle != NULL)
-		{
-			triangles->push_back(triangle);
-		}
+		// Generate the triangle and add it only if it is not degenerated
+		buildTriangle(V0, V1, V2, V3, isovalue, snap, triangles);
 	}
 	else if (s0 == 0 && s1 == 1 && s2 == 0 && s3 == 0)
 	{
@@ -147,21 +198,12 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 		// One positive vertex, all others negative => One triangle
 		// Vertices are in edges 1-2, 1-3 and 1-0
 
-		// Generate the triangle and add it only if it is not NULL
-		// NOTE: A triangle is NULL if it is a degenerated triangle
-		Triangle* triangle = buildTriangle(V1, V2, V0, V3, isovalue);
-		if (triangle != NULL)
-		{
-			triangles->push_back(triangle);
-		}
+		// Generate the triangle and add it only if it is not degenerated
+		buildTriangle(V1, V2, V0, V3, isovalue, snap, triangles);
 	}
 	else if (s0 == 1 && s1 == 1 && s2 == 0 && s3 == 0)
 	{
-		std::vector<Triangle*>* t = buildTriangles(V0, V1, V2, V3, isovalue);
-		for (auto it = t->begin(); it != t->end(); ++it)
-		{
-			triangles->push_back(*it);
-		}
+		buildTriangles(V0, V1, V2, V3, isovalue, snap, triangles);
 	}
 	else if (s0 == 0 && s1 == 0 && s2 == 1 && s3 == 0)
 	{
@@ -169,29 +211,16 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 		// One positive vertex, all others negative => One triangle
 		// Vertices are in edges 2-0, 2-1 and 2-3
 
-		// Generate the triangle and add it only if it is not NULL
-		// NOTE: A triangle is NULL if it is a degenerated triangle
-		Triangle* triangle = buildTriangle(V2, V0, V1, V3, isovalue);
-		if (triangle != NULL)
-		{
-			triangles->push_back(triangle);
-		}
+		// Generate the triangle and add it only if it is not degenerated
+		buildTriangle(V2, V0, V1, V3, isovalue, snap, triangles);
 	}
 	else if (s0 == 1 && s1 == 0 && s2 == 1 && s3 == 0)
 	{
-		std::vector<Triangle*>* t = buildTriangles(V0, V2, V1, V3, isovalue);
-		for (auto it = t->begin(); it != t->end(); ++it)
-		{
-			triangles->push_back(*it);
-		}
+		buildTriangles(V0, V2, V1, V3, isovalue, snap, triangles);
 	}
 	else if (s0 == 0 && s1 == 1 && s2 == 1 && s3 == 0)
 	{
-		std::vector<Triangle*>* t = buildTriangles(V1, V2, V0, V3, isovalue);
-		for (auto it = t->begin(); it != t->end(); ++it)
-		{
-			triangles->push_back(*it);
-		}
+		buildTriangles(V1, V2, V0, V3, isovalue, snap, triangles);
 
 	}
 	else if (s0 == 1 && s1 == 1 && s2 == 1 && s3 == 0)
@@ -200,13 +229,8 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 		// One negative vertex, all others positive => One triangle
 		// Vertices are in edges 3-2, 3-0 and 3-1
 
-		// Generate the triangle and add it only if it is not NULL
-		// NOTE: A triangle is NULL if it is a degenerated triangle
-		Triangle* triangle = buildTriangle(V3, V0, V2, V1, isovalue);
-		if (triangle != NULL)
-		{
-			triangles->push_back(triangle);
-		}
+		// Generate the triangle and add it only if it is not degenerated
+		buildTriangle(V3, V0, V2, V1, isovalue, snap, triangles);
 	}
 	else if (s0 == 0 && s1 == 0 && s2 == 0 && s3 == 1)
 	{
@@ -214,29 +238,16 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 		// One positive vertex, all others negative => One triangle
 		// Vertices are in edges 3-2, 3-0 and 3-1
 
-		// Generate the triangle and add it only if it is not NULL
-		// NOTE: A triangle is NULL if it is a degenerated triangle
-		Triangle* triangle = buildTriangle(V3, V2, V1, V0, isovalue);
-		if (triangle != NULL)
-		{
-			triangles->push_back(triangle);
-		}
+		// Generate the triangle and add it only if it is not degenerated
+		buildTriangle(V3, V2, V1, V0, isovalue, snap, triangles);
 	}
 	else if (s0 == 1 && s1 == 0 && s2 == 0 && s3 == 1)
 	{
-		std::vector<Triangle*>* t = buildTriangles(V0, V3, V1, V2, isovalue);
-		for (auto it = t->begin(); it != t->end(); ++it)
-		{
-			triangles->push_back(*it);
-		}
+		buildTriangles(V0, V3, V1, V2, isovalue, snap, triangles);
 	}
 	else if (s0 == 0 && s1 == 1 && s2 == 0 && s3 == 1)
 	{
-		std::vector<Triangle*>* t = buildTriangles(V1, V3, V0, V2, isovalue);
-		for (auto it = t->begin(); it != t->end(); ++it)
-		{
-			triangles->push_back(*it);
-		}
+		buildTriangles(V1, V3, V0, V2, isovalue, snap, triangles);
 	}
 	else if (s0 == 1 && s1 == 1 && s2 == 0 && s3 == 1)
 	{
@@ -244,21 +255,12 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 		// One negative vertex, all others positive => One triangle
 		// Vertices are in edges 2-0, 2-3 and 2-1
 
-		// Generate the triangle and add it only if it is not NULL
-		// NOTE: A triangle is NULL if it is a degenerated triangle
-		Triangle* triangle = buildTriangle(V2, V0, V1, V3, isovalue);
-		if (triangle != NULL)
-		{
-			triangles->push_back(triangle);
-		}
+		// Generate the triangle and add it only if it is not degenerated
+		buildTriangle(V2, V0, V1, V3, isovalue, snap, triangles);
 	}
 	else if (s0 == 0 && s1 == 0 && s2 == 1 && s3 == 1)
 	{
-		std::vector<Triangle*>* t = buildTriangles(V2, V3, V0, V1, isovalue);
-		for (auto it = t->begin(); it != t->end(); ++it)
-		{
-			triangles->push_back(*it);
-		}
+		buildTriangles(V2, V3, V0, V1, isovalue, snap, triangles);
 	}
 	else if (s0 == 1 && s1 == 0 && s2 == 1 && s3 == 1)
 	{
@@ -266,13 +268,8 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 		// One negative vertex, all others positive => One triangle
 		// Vertices are in edges 1-2, 1-3 and 1-0
 
-		// Generate the triangle and add it only if it is not NULL
-		// NOTE: A triangle is NULL if it is a degenerated triangle
-		Triangle* triangle = buildTriangle(V1, V2, V0, V3, isovalue);
-		if (triangle != NULL)
-		{
-			triangles->push_back(triangle);
-		}
+		// Generate the triangle and add it only if it is not degenerated
+		buildTriangle(V1, V2, V0, V3, isovalue, snap, triangles);
 
 	}
 	else if (s0 == 0 && s1 == 1 && s2 == 1 && s3 == 1)
@@ -281,13 +278,8 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 		// One negative vertex, all others positive => One triangle
 		// Vertices are in edges 0-1, 0-3 and 0-2
 
-		// Generate the triangle and add it only if it is not NULL
-		// NOTE: A triangle is NULL if it is a degenerated triangle
-		Triangle* triangle = buildTriangle(V0, V1, V2, V3, isovalue);
-		if (triangle != NULL)
-		{
-			triangles->push_back(triangle);
-		}
+		// Generate the triangle and add it only if it is not degenerated
+		buildTriangle(V0, V1, V2, V3, isovalue, snap, triangles);
 	}
 	else if (s0 == 1 && s1 == 1 && s2 == 1 && s3 == 1)
 	{
@@ -297,9 +289,6 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 	{
 		// Something weird is occuring here!
 	}
-
-	// Return the generated triangles
-	return triangles;
 }
 
 /*
@@ -312,57 +301,418 @@ std::vector<Triangle*>* marchTetrahedra(Vector3* V0, Vector3* V1, Vector3* V2, V
 	@param v5
 	@param v6
 	@param isovalue
-	@return The pointer to the vector containing the triangles from the cell
+	@param snap
+	@param triangles The vector where the triangles from the cell are appended
 */
-std::vector<Triangle*>* marchCellTetrahedra(Vector3* v0, Vector3* v1, Vector3* v2, Vector3* v3,
-                                            Vector3* v4, Vector3* v5, Vector3* v6, Vector3* v7, double isovalue)
+void marchCellTetrahedra(const Vector3& v0, const Vector3& v1, const Vector3& v2, const Vector3& v3,
+                         const Vector3& v4, const Vector3& v5, const Vector3& v6, const Vector3& v7,
+                         double isovalue, double snap, std::vector<Triangle>& triangles)
 {
-    // Initialize the vector where the triangles will be stored
-    std::vector<Triangle*>* triangles = new std::vector<Triangle*>();
-
     // Run the march algorithm on each tetrahedra and keep the generated triangles
-    std::vector<Triangle*>* tetrahedra1Triangles = marchTetrahedra(v0, v1, v3, v5, isovalue);
-    std::vector<Triangle*>* tetrahedra2Triangles = marchTetrahedra(v1, v2, v3, v5, isovalue);
-    std::vector<Triangle*>* tetrahedra3Triangles = marchTetrahedra(v0, v3, v4, v5, isovalue);
-    std::vector<Triangle*>* tetrahedra4Triangles = marchTetrahedra(v2, v3, v5, v6, isovalue);
-    std::vector<Triangle*>* tetrahedra5Triangles = marchTetrahedra(v3, v4, v5, v7, isovalue);
-    std::vector<Triangle*>* tetrahedra6Triangles = marchTetrahedra(v3, v5, v6, v7, isovalue);
-
-    // Merge the tetrahedra vectors into the general one
-    for (auto it = tetrahedra1Triangles->begin(); it != tetrahedra1Triangles->end(); ++it)
-    {
-        triangles->push_back(*it);
-    }
+    marchTetrahedra(v0, v1, v3, v5, isovalue, snap, triangles);
+    marchTetrahedra(v1, v2, v3, v5, isovalue, snap, triangles);
+    marchTetrahedra(v0, v3, v4, v5, isovalue, snap, triangles);
+    marchTetrahedra(v2, v3, v5, v6, isovalue, snap, triangles);
+    marchTetrahedra(v3, v4, v5, v7, isovalue, snap, triangles);
+    marchTetrahedra(v3, v5, v6, v7, isovalue, snap, triangles);
+}
 
-    for (auto it = tetrahedra2Triangles->begin(); it != tetrahedra2Triangles->end(); ++it)
-    {
-        triangles->push_back(*it);
-    }
+/*
+	Run the marching tetrahedra on the five tetrahedra split of the cell: the central tetrahedron
+	spans the corners of even (or odd) parity, and each of the other four corners is cut off with
+	its three neighbours. Neighbouring cells have opposite parities, so the face diagonals match
+	@param v0 ... v7 The corners of the cell, in the order of marchCellTetrahedra
+	@param odd Use the central tetrahedron of the odd corners (v1, v3, v4, v6)
+	@param isovalue
+	@param snap
+	@param triangles The vector where the triangles from the cell are appended
+*/
+void marchCellFiveTetrahedra(const Vector3& v0, const Vector3& v1, const Vector3& v2, const Vector3& v3,
+                             const Vector3& v4, const Vector3& v5, const Vector3& v6, const Vector3& v7,
+                             bool odd, double isovalue, double snap, std::vector<Triangle>& triangles)
+{
+	if (odd)
+	{
+		marchTetrahedra(v1, v3, v4, v6, isovalue, snap, triangles);
+		marchTetrahedra(v0, v1, v3, v4, isovalue, snap, triangles);
+		marchTetrahedra(v2, v1, v3, v6, isovalue, snap, triangles);
+		marchTetrahedra(v5, v1, v4, v6, isovalue, snap, triangles);
+		marchTetrahedra(v7, v3, v4, v6, isovalue, snap, triangles);
+	}
+	else
+	{
+		marchTetrahedra(v0, v2, v5, v7, isovalue, snap, triangles);
+		marchTetrahedra(v1, v0, v2, v5, isovalue, snap, triangles);
+		marchTetrahedra(v3, v0, v2, v7, isovalue, snap, triangles);
+		marchTetrahedra(v4, v0, v5, v7, isovalue, snap, triangles);
+		marchTetrahedra(v6, v2, v5, v7, isovalue, snap, triangles);
+	}
+}
 
-    for (auto it = tetrahedra3Triangles->begin(); it != tetrahedra3Triangles->end(); ++it)
-    {
-        triangles->push_back(*it);
-    }
+/*
+	Lists the triangles marchTetrahedra builds in the tetrahedron (four corners of a cell) as the
+	pairs of corners of their cut edges. The vertices of every triangle are in the order
+	buildTriangle and buildTriangles build them, before they are oriented. Degenerate triangles
+	are not discarded
+	@param tetrahedron The corners of the tetrahedron
+	@param mask The bit mask of the corners of the cell above the isovalue
+	@param edges The corners of the cut edges of every triangle
+	@param order The corners of the tetrahedron in the order they are given to buildTriangle or
+	buildTriangles, which breaks the ties of orientationReference
+	@return The number of triangles
+*/
+int tetrahedronTriangles(const int* tetrahedron, unsigned mask, int edges[2][3][2], int order[4])
+{
+	int positive[4], negative[4];
+	int num_positive = 0, num_negative = 0;
+	for (int c = 0; c < 4; ++c)
+	{
+		if ((mask >> tetrahedron[c]) & 1)
+		{
+			positive[num_positive++] = c;
+		}
+		else
+		{
+			negative[num_negative++] = c;
+		}
+	}
 
-    for (auto it = tetrahedra4Triangles->begin(); it != tetrahedra4Triangles->end(); ++it)
-    {
-        triangles->push_back(*it);
-    }
+	if (num_positive == 0 || num_negative == 0)
+	{
+		return 0;
+	}
 
-    for (auto it = tetrahedra5Triangles->begin(); it != tetrahedra5Triangles->end(); ++it)
-    {
-        triangles->push_back(*it);
-    }
+	if (num_positive == 2)
+	{
+		// Quad between the positive pair (A, B) and the negative pair (C, D) as in buildTriangles:
+		// (AC, BC, BD) and (BD, AD, AC)
+		int A = tetrahedron[positive[0]], B = tetrahedron[positive[1]];
+		int C = tetrahedron[negative[0]], D = tetrahedron[negative[1]];
+		const int quad[4][2] = {{A, C}, {B, C}, {B, D}, {A, D}};
+		const int triangles[2][3] = {{0, 1, 2}, {2, 3, 0}};
+		for (int t = 0; t < 2; ++t)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				edges[t][e][0] = quad[triangles[t][e]][0];
+				edges[t][e][1] = quad[triangles[t][e]][1];
+			}
+		}
+		order[0] = A; order[1] = B; order[2] = C; order[3] = D;
+		return 2;
+	}
 
-    for (auto it = tetrahedra6Triangles->begin(); it != tetrahedra6Triangles->end(); ++it)
-    {
-        triangles->push_back(*it);
-    }
+	// The vertex with a different sign from the other three and the arguments V1, V2 and V3 it
+	// is given to buildTriangle with, whose triangle has the vertices on the edges to V1, V3 and V2
+	int lone = (num_positive == 1) ? positive[0] : negative[0];
+	const int arguments[4][3] = {{1, 2, 3}, {2, 0, 3}, {0, 1, 3},
+	                             {(num_positive == 1) ? 2 : 0, (num_positive == 1) ? 1 : 2,
+	                              (num_positive == 1) ? 0 : 1}};
+	const int vertices[3] = {0, 2, 1};
+	order[0] = tetrahedron[lone];
+	for (int e = 0; e < 3; ++e)
+	{
+		edges[0][e][0] = tetrahedron[lone];
+		edges[0][e][1] = tetrahedron[arguments[lone][vertices[e]]];
+		order[e + 1] = tetrahedron[arguments[lone][e]];
+	}
+	return 1;
+}
+
+/*
+	Returns the tetrahedra of a cell with the split of decomposition, in the order of
+	marchCellTetrahedra or marchCellFiveTetrahedra. odd is the parity of the sum of the grid
+	indices of the cell
+*/
+CellSplit cellSplit(Decomposition decomposition, bool odd)
+{
+	if (decomposition == Decomposition::five)
+	{
+		return CellSplit{cellFiveTetrahedra[odd ? 1 : 0], 5};
+	}
+	return CellSplit{cellTetrahedra, 6};
+}
+
+/*
+	Returns the bit mask of the directions of edgeDirections whose edges are edges of the
+	tetrahedra with the split of decomposition, for a grid point of parity odd. The five
+	tetrahedra split only has the face diagonals between the grid points of even parity
+*/
+unsigned pointDirections(Decomposition decomposition, bool odd)
+{
+	if (decomposition == Decomposition::five)
+	{
+		return odd ? 0x7u : 0x3BFu;
+	}
+	return 0x7Fu;
+}
+
+/*
+	Returns the number of triangles built in a cell whose corners above the isovalue are the bits
+	of mask, including the degenerate ones, with the split of decomposition (odd is the parity of
+	the cell)
+*/
+int cellTriangleCount(unsigned mask, Decomposition decomposition, bool odd)
+{
+	struct Table
+	{
+		// Six tetrahedra, and five tetrahedra in even and odd cells
+		int count[3][256];
+
+		Table() {
+			const CellSplit splits[3] = {cellSplit(Decomposition::six, false),
+			                             cellSplit(Decomposition::five, false),
+			                             cellSplit(Decomposition::five, true)};
+			int edges[2][3][2], order[4];
+			for (int s = 0; s < 3; ++s)
+			{
+				for (unsigned m = 0; m < 256; ++m)
+				{
+					count[s][m] = 0;
+					for (auto& tetrahedron : splits[s])
+					{
+						count[s][m] += tetrahedronTriangles(tetrahedron, m, edges, order);
+					}
+				}
+			}
+		}
+	};
+	static const Table table;
+	return table.count[decomposition == Decomposition::five ? 1 + odd : 0][mask];
+}
+
+/*
+	Returns the number of triangles of a cell collapsed to one of its corners: the ones of the
+	tetrahedra with three corners above the isovalue (the bits of mask) and the fourth on it (one
+	of the bits of on), with the split of decomposition (odd is the parity of the cell)
+*/
+int cellPointTriangleCount(unsigned mask, unsigned on, Decomposition decomposition, bool odd)
+{
+	int count = 0;
+	for (auto& tetrahedron : cellSplit(decomposition, odd))
+	{
+		int above = 0;
+		unsigned corners = 0;
+		for (int c = 0; c < 4; ++c)
+		{
+			above += (mask >> tetrahedron[c]) & 1;
+			corners |= 1u << tetrahedron[c];
+		}
+		if (above == 3 && (on & corners) != 0)
+		{
+			++count;
+		}
+	}
+	return count;
+}
+
+/*
+	Returns the corner of the cell where the edge between corners a and b starts and the index of
+	its direction in edgeDirections
+*/
+void cellEdge(int a, int b, int& start, int& direction)
+{
+	for (int d = 0; d < numDirections; ++d)
+	{
+		const int* delta = edgeDirections[d];
+		bool forward = true, backward = true;
+		for (int c = 0; c < 3; ++c)
+		{
+			int difference = cellCorners[b][c] - cellCorners[a][c];
+			forward &= difference == delta[c];
+			backward &= difference == -delta[c];
+		}
 
-    // Return the triangles
-    return triangles;
+		if (forward || backward)
+		{
+			start = forward ? a : b;
+			direction = d;
+			return;
+		}
+	}
+	start = direction = -1;
 }
 
 }
 
+void compact_vertices(std::vector<double>& vertices, std::vector<size_t>& polygons,
+                      std::vector<double>& attributes, size_t num_attributes)
+{
+	const size_t unused = static_cast<size_t>(-1);
+	size_t num_vertices = vertices.size() / 3;
+
+	// Mark the referenced vertices
+	std::vector<size_t> new_index(num_vertices, unused);
+	for (auto p : polygons)
+	{
+		new_index[p] = 0;
+	}
+
+	// Number them keeping their original order and move their data
+	size_t count = 0;
+	for (size_t i = 0; i < num_vertices; ++i)
+	{
+		if (new_index[i] == unused)
+		{
+			continue;
+		}
+
+		new_index[i] = count;
+		std::copy(vertices.begin() + 3 * i, vertices.begin() + 3 * (i + 1),
+		          vertices.begin() + 3 * count);
+		std::copy(attributes.begin() + num_attributes * i, attributes.begin() + num_attributes * (i + 1),
+		          attributes.begin() + num_attributes * count);
+		++count;
+	}
+	vertices.resize(3 * count);
+	attributes.resize(num_attributes * count);
+
+	for (auto& p : polygons)
+	{
+		p = new_index[p];
+	}
+}
+
+size_t remove_degenerate_triangles(std::vector<double>& vertices, std::vector<size_t>& polygons,
+                                   std::vector<double>& attributes, size_t num_attributes,
+                                   double tolerance)
+{
+	size_t num_triangles = polygons.size() / 3;
+	size_t kept = 0;
+	for (size_t t = 0; t < num_triangles; ++t)
+	{
+		size_t i0 = polygons[3 * t], i1 = polygons[3 * t + 1], i2 = polygons[3 * t + 2];
+
+		// Collapsed triangles
+		if (i0 == i1 || i1 == i2 || i2 == i0)
+		{
+			continue;
+		}
+
+		// Zero-area triangles: |e1 x e2| = longest edge * height
+		Vector3 A(vertices[3 * i0], vertices[3 * i0 + 1], vertices[3 * i0 + 2]);
+		Vector3 B(vertices[3 * i1], vertices[3 * i1 + 1], vertices[3 * i1 + 2]);
+		Vector3 C(vertices[3 * i2], vertices[3 * i2 + 1], vertices[3 * i2 + 2]);
+		double twice_area = B.sub(A).cross(C.sub(A)).magnitude();
+		double longest = std::max(A.squareDistance(B), std::max(B.squareDistance(C), C.squareDistance(A)));
+		if (twice_area <= tolerance * longest)
+		{
+			continue;
+		}
+
+		polygons[3 * kept] = i0;
+		polygons[3 * kept + 1] = i1;
+		polygons[3 * kept + 2] = i2;
+		++kept;
+	}
+	polygons.resize(3 * kept);
+
+	compact_vertices(vertices, polygons, attributes, num_attributes);
+	return num_triangles - kept;
+}
+
+size_t label_components(const std::vector<size_t>& polygons, size_t num_vertices,
+                        std::vector<size_t>& labels)
+{
+	const size_t unused = static_cast<size_t>(-1);
+	size_t num_triangles = polygons.size() / 3;
+
+	// Join the vertices of every triangle
+	UnionFind sets(num_vertices);
+	for (size_t t = 0; t < num_triangles; ++t)
+	{
+		sets.unite(polygons[3 * t], polygons[3 * t + 1]);
+		sets.unite(polygons[3 * t], polygons[3 * t + 2]);
+	}
+
+	// Give consecutive labels to the roots and count the triangles of each shell
+	std::vector<size_t> root_label(num_vertices, unused);
+	std::vector<size_t> sizes;
+	labels.resize(num_triangles);
+	for (size_t t = 0; t < num_triangles; ++t)
+	{
+		size_t root = sets.find(polygons[3 * t]);
+		if (root_label[root] == unused)
+		{
+			root_label[root] = sizes.size();
+			sizes.push_back(0);
+		}
+		labels[t] = root_label[root];
+		++sizes[labels[t]];
+	}
+
+	// Sort the shells by decreasing size (ties keep the order of appearance)
+	std::vector<size_t> order(sizes.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(),
+	                 [&](size_t a, size_t b) -> bool { return sizes[a] > sizes[b]; });
+
+	std::vector<size_t> rank(order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		rank[order[i]] = i;
+	}
+	for (auto& label : labels)
+	{
+		label = rank[label];
+	}
+
+	return sizes.size();
+}
+
+size_t filter_components(std::vector<double>& vertices, std::vector<size_t>& polygons,
+                         std::vector<size_t>& labels, std::vector<double>& attributes,
+                         size_t num_attributes, size_t min_triangles, bool keep_largest)
+{
+	// Count the triangles of each shell
+	std::vector<size_t> sizes;
+	for (auto label : labels)
+	{
+		if (label >= sizes.size())
+		{
+			sizes.resize(label + 1, 0);
+		}
+		++sizes[label];
+	}
+
+	// Select the shells to keep. Labels are sorted by size, so the largest one is 0
+	std::vector<size_t> new_label(sizes.size());
+	size_t count = 0;
+	for (size_t l = 0; l < sizes.size(); ++l)
+	{
+		bool keep = sizes[l] >= min_triangles && (!keep_largest || l == 0);
+		new_label[l] = keep ? count++ : static_cast<size_t>(-1);
+	}
+
+	if (count == sizes.size())
+	{
+		return count;
+	}
+
+	// Remove the triangles of the dropped shells
+	size_t num_triangles = labels.size();
+	size_t kept = 0;
+	for (size_t t = 0; t < num_triangles; ++t)
+	{
+		if (new_label[labels[t]] == static_cast<size_t>(-1))
+		{
+			continue;
+		}
+
+		polygons[3 * kept] = polygons[3 * t];
+		polygons[3 * kept + 1] = polygons[3 * t + 1];
+		polygons[3 * kept + 2] = polygons[3 * t + 2];
+		labels[kept] = new_label[labels[t]];
+		++kept;
+	}
+	polygons.resize(3 * kept);
+	labels.resize(kept);
+
+	compact_vertices(vertices, polygons, attributes, num_attributes);
+	return count;
+}
+
 }
@@ -6,16 +6,612 @@
 #include <array>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <thread>
+#include <exception>
+#include <system_error>
 #include "Vector3.h"
 #include "Triangle.h"
+#include "VertexMap.h"
 
 namespace mc
 {
 
+/*
+    Split of the cells into tetrahedra:
+        six: 6 tetrahedra around the diagonal (-+-)(+-+) of every cell
+        five: a central tetrahedron and the 4 tetrahedra at the corners around it, mirrored in
+        every other cell (checkerboard parity) so the diagonals of the shared faces match. It
+        gives about 20% less triangles, at the cost of a bit less regular meshes
+*/
+enum class Decomposition
+{
+    six,
+    five
+};
+
 namespace private_
 {
-    std::vector<Triangle*>* marchCellTetrahedra(Vector3* v0, Vector3* v1, Vector3* v2, Vector3* v3,
-                                                Vector3* v4, Vector3* v5, Vector3* v6, Vector3* v7, double isovalue);
+    void marchCellTetrahedra(const Vector3& v0, const Vector3& v1, const Vector3& v2, const Vector3& v3,
+                             const Vector3& v4, const Vector3& v5, const Vector3& v6, const Vector3& v7,
+                             double isovalue, double snap, std::vector<Triangle>& triangles);
+    void marchCellFiveTetrahedra(const Vector3& v0, const Vector3& v1, const Vector3& v2, const Vector3& v3,
+                                 const Vector3& v4, const Vector3& v5, const Vector3& v6, const Vector3& v7,
+                                 bool odd, double isovalue, double snap, std::vector<Triangle>& triangles);
+    double inverseLinearInterpolation(double f, double f1, double f2, double snap);
+
+    // Grid offsets of the corners of a cell, in the order of marchCell
+    extern const int cellCorners[8][3];
+
+    // Tetrahedra of a cell, as in marchCellTetrahedra
+    extern const int cellTetrahedra[6][4];
+
+    // Tetrahedra of the even and odd cells, as in marchCellFiveTetrahedra
+    extern const int cellFiveTetrahedra[2][5][4];
+
+    // Tetrahedra of a cell with one of the splits (see cellSplit)
+    struct CellSplit
+    {
+        const int (*tetrahedra)[4];
+        int count;
+
+        const int (*begin() const)[4] {
+            return tetrahedra;
+        }
+
+        const int (*end() const)[4] {
+            return tetrahedra + count;
+        }
+    };
+
+    // Directions of the edges of the tetrahedra of both splits: the six tetrahedra use the first
+    // seven and the five tetrahedra the three edges of the cells and the six face diagonals
+    // between grid points of even parity. Every edge is attached to the grid point where it
+    // starts, so each edge of the grid has a single owner
+    const int numDirections = 10;
+    extern const int edgeDirections[numDirections][3];
+
+    // States of the grid points in MeshCounts::signs (below the isovalue otherwise)
+    const unsigned char aboveIsovalue = 1;
+    const unsigned char onIsovalue = 2;
+
+    // Slots of the vertices attached to a grid point: one per direction of edgeDirections, and
+    // the grid point itself (see vertexMask)
+    const int pointSlot = numDirections;
+    const int vertexSlots = numDirections + 1;
+
+    CellSplit cellSplit(Decomposition decomposition, bool odd);
+    unsigned pointDirections(Decomposition decomposition, bool odd);
+    int tetrahedronTriangles(const int* tetrahedron, unsigned mask, int edges[2][3][2], int order[4]);
+    int cellTriangleCount(unsigned mask, Decomposition decomposition, bool odd);
+    int cellPointTriangleCount(unsigned mask, unsigned on, Decomposition decomposition, bool odd);
+    void cellEdge(int a, int b, int& start, int& direction);
+
+/*
+    Builds the corners of the cell [x, x_dx] x [y, y_dy] x [z, z_dz] with values v, given in the
+    order (---)(+--)(++-)(-+-)(--+)(+-+)(+++)(-++), and marches its tetrahedra. The num_attributes
+    auxiliary channels of the corners are sampled with g into corner_attributes (num_attributes
+    values per corner) only when the cell is crossed by the isosurface. The triangles from the
+    cell are appended to triangles. With the five tetrahedra split, odd must be the parity of the
+    sum of the grid indices of the cell
+*/
+template<Decomposition decomposition = Decomposition::six, typename coord_type, typename attribute_formula>
+void marchCell(coord_type x, coord_type x_dx, coord_type y, coord_type y_dy,
+               coord_type z, coord_type z_dz, const double* v, double isovalue,
+               attribute_formula g, int num_attributes, double* corner_attributes,
+               double snap, std::vector<Triangle>& triangles, bool odd = false)
+{
+    // 0-8: (---)(+--)(+-+)(--+)(-+-)(++-)(+++)(-++)
+    // swap y z
+    Vector3 corners[8] = {
+        Vector3(x, z, y), Vector3(x_dx, z, y), Vector3(x_dx, z, y_dy), Vector3(x, z, y_dy),
+        Vector3(x, z_dz, y), Vector3(x_dx, z_dz, y), Vector3(x_dx, z_dz, y_dy), Vector3(x, z_dz, y_dy)
+    };
+
+    // Isovalue of each point
+    for (int c = 0; c < 8; ++c)
+    {
+        corners[c].info = v[c];
+        corners[c].corner0 = corners[c].corner1 = c;
+    }
+
+    // Sample the auxiliary channels only in the cells crossed by the isosurface
+    if (num_attributes > 0)
+    {
+        bool positive = false, negative = false;
+        for (int c = 0; c < 8; ++c)
+        {
+            positive |= v[c] > isovalue;
+            negative |= v[c] <= isovalue;
+        }
+
+        if (positive && negative)
+        {
+            for (int c = 0; c < 8; ++c)
+            {
+                g(corners[c].x, corners[c].z, corners[c].y, corner_attributes + c * num_attributes); // swap y z back
+            }
+        }
+    }
+
+    if (decomposition == Decomposition::five)
+    {
+        marchCellFiveTetrahedra(corners[0], corners[1], corners[2], corners[3],
+                                corners[4], corners[5], corners[6], corners[7], odd, isovalue, snap, triangles);
+    }
+    else
+    {
+        marchCellTetrahedra(corners[0], corners[1], corners[2], corners[3],
+                            corners[4], corners[5], corners[6], corners[7], isovalue, snap, triangles);
+    }
+}
+
+/*
+    Appends the triangles to polygons. Their vertices are looked up in vertex_map, and the ones
+    that are not there yet are added to the map and to vertices. The auxiliary channels of the
+    new vertices are interpolated from corner_attributes (see marchCell) along the edges they
+    were built on, and appended to attributes
+*/
+template<typename size_type>
+void addTriangles(const std::vector<Triangle>& triangles, VertexMap& vertex_map,
+                  std::vector<double>& vertices, std::vector<size_type>& polygons,
+                  std::vector<double>& attributes, int num_attributes, const double* corner_attributes)
+{
+    // Lambda to add a new vertex to both the list and hash map
+    auto add_vertex = [&](const Vector3& v) -> int {
+        bool inserted;
+        int id = vertex_map.insert(v, inserted);
+        if (inserted) {
+            vertices.push_back(v.x);
+            vertices.push_back(v.z); // swap y z back
+            vertices.push_back(v.y);
+
+            const double* a0 = corner_attributes + v.corner0 * num_attributes;
+            const double* a1 = corner_attributes + v.corner1 * num_attributes;
+            for (int a = 0; a < num_attributes; ++a)
+                attributes.push_back((1.0 - v.t) * a0[a] + v.t * a1[a]);
+        }
+        return id;
+    };
+
+    for (auto& tri : triangles) {
+        polygons.push_back(add_vertex(tri.v0));
+        polygons.push_back(add_vertex(tri.v2));
+        polygons.push_back(add_vertex(tri.v1));
+    }
+}
+
+}
+
+/*
+    Buffers reused between extractions so that extracting many volumes does not allocate memory
+    once they have grown to the largest mesh. A workspace cannot be shared by concurrent
+    extractions
+*/
+struct Workspace
+{
+    // Triangles of the cell being marched
+    std::vector<Triangle> triangles;
+
+    // Auxiliary channels at the corners of the cell being marched
+    std::vector<double> corner_attributes;
+
+    // Index of the vertices already in the mesh
+    VertexMap vertex_map;
+};
+
+/*
+    Result of the counting pass of the two-pass extraction (see count_mesh and write_mesh)
+*/
+struct MeshCounts
+{
+    // Number of grid points in each direction
+    int numx = 0, numy = 0, numz = 0;
+
+    // Split of the cells into tetrahedra
+    Decomposition decomposition = Decomposition::six;
+
+    // State of each grid point: above, on or below the isovalue (see private_::pointState)
+    std::vector<unsigned char> signs;
+
+    // Index of the first vertex of each row of grid points (i, j), followed by the total
+    std::vector<size_t> row_vertices{0};
+
+    // Index of the first triangle of each slab of cells along x, followed by the total
+    std::vector<size_t> slab_triangles{0};
+
+    // Scratch space of write_mesh for the indices of the vertices of four rows per thread
+    std::vector<size_t> edge_ids;
+
+    size_t num_vertices() const {
+        return row_vertices.back();
+    }
+
+    size_t num_triangles() const {
+        return slab_triangles.back();
+    }
+};
+
+namespace private_
+{
+
+/*
+    Splits [0, count) into num_threads contiguous ranges and calls task(first, last, range) on
+    each of them in its own thread, where range is the index of the range. A range whose thread
+    cannot be started runs in the calling thread. The first exception thrown by a task is
+    rethrown once all of them have ended
+*/
+template<typename task_type>
+void parallelRanges(int count, int num_threads, task_type task)
+{
+    num_threads = std::max(1, std::min(num_threads, count));
+    std::vector<std::exception_ptr> errors(num_threads);
+    auto run = [&](int first, int last, int range) {
+        try
+        {
+            task(first, last, range);
+        }
+        catch(...)
+        {
+            errors[range] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (int t = 1; t < num_threads; ++t)
+    {
+        int first = static_cast<int>(static_cast<long long>(count) * t / num_threads);
+        int last = static_cast<int>(static_cast<long long>(count) * (t + 1) / num_threads);
+        try
+        {
+            threads.emplace_back(run, first, last, t);
+        }
+        catch(const std::system_error&)
+        {
+            run(first, last, t);
+        }
+    }
+    run(0, count / num_threads, 0);
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    for (auto& error : errors)
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+/*
+    Marches the cells [first, last) x [0, numy) x [0, numz) of the grid of points lower + (i*dx,
+    j*dy, k*dz) with values sample(i, j, k), in order, and appends their triangles to polygons.
+    The vertices are numbered from 0 in the order they are found, with the vertex map of
+    workspace, and appended to vertices (and their auxiliary channels to attributes)
+*/
+template<Decomposition decomposition, typename vector3, typename sampler, typename attribute_formula>
+void marchSlab(const vector3& lower, typename vector3::value_type dx, typename vector3::value_type dy,
+               typename vector3::value_type dz, int first, int last, int numy, int numz,
+               sampler sample, double isovalue, attribute_formula g, int num_attributes,
+               std::vector<double>& vertices, std::vector<typename vector3::size_type>& polygons,
+               std::vector<double>& attributes, double snap, Workspace& workspace)
+{
+    using coord_type = typename vector3::value_type;
+
+    // Hash map to record the index
+    VertexMap& vertex_map = workspace.vertex_map;
+    vertex_map.clear();
+    workspace.corner_attributes.resize(8 * static_cast<size_t>(num_attributes));
+    double* corner_attributes = workspace.corner_attributes.data();
+
+    for(int i=first; i<last; ++i)
+    {
+        coord_type x = lower[0] + dx*i;
+        coord_type x_dx = lower[0] + dx*(i+1);
+
+        for(int j=0; j<numy; ++j)
+        {
+            coord_type y = lower[1] + dy*j;
+            coord_type y_dy = lower[1] + dy*(j+1);
+
+            double v[8];
+            v[4] = sample(i, j, 0); v[5] = sample(i+1, j, 0);
+            v[6] = sample(i+1, j+1, 0); v[7] = sample(i, j+1, 0);
+
+            for(int k=0; k<numz; ++k)
+            {
+                coord_type z = lower[2] + dz*k;
+                coord_type z_dz = lower[2] + dz*(k+1);
+
+                // 0-8: (---)(+--)(++-)(-+-)(--+)(+-+)(+++)(-++)
+                v[0] = v[4]; v[1] = v[5];
+                v[2] = v[6]; v[3] = v[7];
+                v[4] = sample(i, j, k+1); v[5] = sample(i+1, j, k+1);
+                v[6] = sample(i+1, j+1, k+1); v[7] = sample(i, j+1, k+1);
+
+                // March the cell's tetrahedra and add its triangles to the mesh. Cells are
+                // visited in order, so the vertices are numbered as they are found
+                workspace.triangles.clear();
+                marchCell<decomposition>(x, x_dx, y, y_dy, z, z_dz, v, isovalue,
+                                         g, num_attributes, corner_attributes, snap,
+                                         workspace.triangles, ((i + j + k) & 1) != 0);
+                addTriangles(workspace.triangles, vertex_map, vertices, polygons,
+                             attributes, num_attributes, corner_attributes);
+            }
+        }
+    }
+}
+
+/*
+    Returns the state of a sample in MeshCounts::signs
+*/
+inline unsigned char pointState(double value, double isovalue)
+{
+    return value > isovalue ? aboveIsovalue : (value == isovalue ? onIsovalue : 0);
+}
+
+/*
+    Returns the bit mask of the corners of the cell (i, j, k) above the isovalue, and sets on to
+    the bit mask of the corners on it
+*/
+inline unsigned cellMask(const MeshCounts& counts, int i, int j, int k, unsigned& on)
+{
+    unsigned mask = 0;
+    on = 0;
+    for (int c = 0; c < 8; ++c)
+    {
+        size_t point = (static_cast<size_t>(i + cellCorners[c][0]) * counts.numy + j + cellCorners[c][1])
+                       * counts.numz + k + cellCorners[c][2];
+        mask |= static_cast<unsigned>(counts.signs[point] & aboveIsovalue) << c;
+        on |= static_cast<unsigned>(counts.signs[point] == onIsovalue) << c;
+    }
+    return mask;
+}
+
+/*
+    Returns whether the grid point (i, j, k), which must be on the isovalue, is a vertex of the
+    mesh: whether one of the tetrahedra around it has one or two corners above the isovalue.
+    Otherwise it is only the vertex of the triangles collapsed to it, which are dropped
+*/
+inline bool isPointVertex(const MeshCounts& counts, int i, int j, int k)
+{
+    for (int c = 0; c < 8; ++c)
+    {
+        // Cell with the grid point at its corner c
+        int i0 = i - cellCorners[c][0], j0 = j - cellCorners[c][1], k0 = k - cellCorners[c][2];
+        if (i0 < 0 || j0 < 0 || k0 < 0 || i0 >= counts.numx - 1 || j0 >= counts.numy - 1 || k0 >= counts.numz - 1)
+        {
+            continue;
+        }
+
+        unsigned on;
+        unsigned mask = cellMask(counts, i0, j0, k0, on);
+        for (auto& tetrahedron : cellSplit(counts.decomposition, (i0 + j0 + k0) & 1))
+        {
+            int above = 0;
+            bool around = false;
+            for (int v = 0; v < 4; ++v)
+            {
+                above += (mask >> tetrahedron[v]) & 1;
+                around |= tetrahedron[v] == c;
+            }
+            if (around && (above == 1 || above == 2))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+    Returns the bit mask of the slots of the vertices attached to the grid point (i, j, k). The
+    cut edges ending at a grid point on the isovalue share the vertex at that point (slot
+    pointSlot), as marching_cubes merges them; the other cut edges have their own vertex, in the
+    slot of their direction
+*/
+inline unsigned vertexMask(const MeshCounts& counts, int i, int j, int k)
+{
+    const size_t plane = static_cast<size_t>(counts.numy) * counts.numz;
+    const unsigned char* point = counts.signs.data() + i * plane + static_cast<size_t>(j) * counts.numz + k;
+
+    if (point[0] == onIsovalue)
+    {
+        return isPointVertex(counts, i, j, k) ? 1u << pointSlot : 0;
+    }
+
+    unsigned mask = 0;
+    unsigned directions = pointDirections(counts.decomposition, (i + j + k) & 1);
+    for (int d = 0; directions != 0; ++d, directions >>= 1)
+    {
+        if (!(directions & 1))
+        {
+            continue;
+        }
+
+        const int* direction = edgeDirections[d];
+        int i1 = i + direction[0], j1 = j + direction[1], k1 = k + direction[2];
+        if (i1 >= counts.numx || j1 < 0 || j1 >= counts.numy || k1 < 0 || k1 >= counts.numz)
+        {
+            continue;
+        }
+
+        // One end above the isovalue and the other one below
+        ptrdiff_t offset = static_cast<ptrdiff_t>(direction[0] * plane) +
+                           direction[1] * counts.numz + direction[2];
+        if (point[0] + point[offset] == aboveIsovalue)
+        {
+            mask |= 1u << d;
+        }
+    }
+    return mask;
+}
+
+/*
+    Returns the corner of the cell and the slot of the vertex of the cut edge between the corners
+    a and b: the end of the edge on the isovalue if there is one (on is the bit mask of the
+    corners on it), otherwise the start of the edge and its direction
+*/
+inline void edgeVertex(int a, int b, unsigned on, int& corner, int& slot)
+{
+    if ((on >> a) & 1)
+    {
+        corner = a;
+        slot = pointSlot;
+    }
+    else if ((on >> b) & 1)
+    {
+        corner = b;
+        slot = pointSlot;
+    }
+    else
+    {
+        cellEdge(a, b, corner, slot);
+    }
+}
+
+/*
+    Numbers the vertices attached to the row of grid points (i, j), by increasing k and slot,
+    starting at the first vertex of the row. The index of the vertex in slot s of point k is
+    stored in ids[vertexSlots*k + s] (if ids is not null)
+    @return The number of vertices of the row
+*/
+inline size_t rowVertexIds(const MeshCounts& counts, int i, int j, size_t* ids)
+{
+    const size_t first = counts.row_vertices[static_cast<size_t>(i) * counts.numy + j];
+
+    size_t id = first;
+    for (int k = 0; k < counts.numz; ++k)
+    {
+        unsigned mask = vertexMask(counts, i, j, k);
+        for (int s = 0; mask != 0; ++s, mask >>= 1)
+        {
+            if (!(mask & 1))
+            {
+                continue;
+            }
+
+            if (ids != nullptr)
+            {
+                ids[vertexSlots * k + s] = id;
+            }
+            ++id;
+        }
+    }
+    return id - first;
+}
+
+/*
+    Returns whether the triangle (A, B, C) built in a tetrahedron must have its last two vertices
+    swapped to get the orientation of marching_cubes. R is the corner of the tetrahedron farthest
+    from the isovalue, and positive whether it is above it. marching_cubes orients the triangles
+    with the y and z coordinates swapped, so the triangles with zero area are kept as they are built
+    when R is above the isovalue and swapped otherwise
+*/
+inline bool swapOrientation(const Vector3& A, const Vector3& B, const Vector3& C, const Vector3& R, bool positive)
+{
+    return positive == (A.sub(R).dot(B.sub(A).cross(C.sub(A))) < 0);
+}
+
+}
+
+/*
+    Removes the vertices that are not referenced by any polygon and renumbers the polygons
+    accordingly. The attributes (num_attributes values per vertex) are compacted alongside
+*/
+void compact_vertices(std::vector<double>& vertices, std::vector<size_t>& polygons,
+                      std::vector<double>& attributes, size_t num_attributes);
+
+/*
+    Removes the collapsed triangles (with repeated vertices) and the triangles with zero area.
+    A triangle is considered to have zero area when its height is not larger than tolerance times
+    its longest edge. The unreferenced vertices are removed afterwards
+    @return The number of removed triangles
+*/
+size_t remove_degenerate_triangles(std::vector<double>& vertices, std::vector<size_t>& polygons,
+                                   std::vector<double>& attributes, size_t num_attributes,
+                                   double tolerance);
+
+/*
+    Labels the connected shells of the mesh. Two triangles belong to the same shell when they
+    are connected through shared vertices. Labels are sorted by decreasing number of triangles,
+    so label 0 is the largest shell
+    @return The number of shells
+*/
+size_t label_components(const std::vector<size_t>& polygons, size_t num_vertices,
+                        std::vector<size_t>& labels);
+
+/*
+    Drops the shells with less than min_triangles triangles and, if keep_largest is set, every
+    shell but the largest one. The vertices and attributes are compacted and the labels of the
+    remaining triangles are renumbered
+    @return The number of remaining shells
+*/
+size_t filter_components(std::vector<double>& vertices, std::vector<size_t>& polygons,
+                         std::vector<size_t>& labels, std::vector<double>& attributes,
+                         size_t num_attributes, size_t min_triangles, bool keep_largest);
+
+/*
+    Extracts the isosurface of f and linearly interpolates num_attributes auxiliary channels at
+    every vertex of the mesh. g(x, y, z, out) must write the num_attributes values of the
+    auxiliary channels at the given grid point into out. The interpolated values are appended
+    to attributes (num_attributes values per vertex, in the same order as vertices).
+    Vertices closer than snap_tolerance (relative to the edge length) to a grid corner are
+    snapped to it. The buffers of workspace are reused by the extraction. The cells are split
+    into tetrahedra as given by decomposition
+*/
+template<Decomposition decomposition = Decomposition::six,
+         typename vector3, typename formula, typename attribute_formula>
+void marching_cubes(const vector3& lower, const vector3& upper,
+    int numx, int numy, int numz, formula f, double isovalue,
+    attribute_formula g, int num_attributes,
+    std::vector<double>& vertices, std::vector<typename vector3::size_type>& polygons,
+    std::vector<double>& attributes, double snap_tolerance, Workspace& workspace)
+{
+    using coord_type = typename vector3::value_type;
+    using namespace private_;
+
+    // Some initial checks
+    if(numx < 2 || numy < 2 || numz < 2)
+        return;
+
+    if(!std::equal(std::begin(lower), std::end(lower), std::begin(upper),
+                   [](double a, double b)->bool {return a <= b;}))
+        return;
+
+    // numx, numy and numz are the numbers of evaluations in each direction
+    --numx; --numy; --numz;
+
+    coord_type dx = (upper[0] - lower[0]) / static_cast<coord_type>(numx);
+    coord_type dy = (upper[1] - lower[1]) / static_cast<coord_type>(numy);
+    coord_type dz = (upper[2] - lower[2]) / static_cast<coord_type>(numz);
+
+    auto sample = [&](int i, int j, int k) -> double {
+        return f(lower[0] + dx*i, lower[1] + dy*j, lower[2] + dz*k);
+    };
+    marchSlab<decomposition>(lower, dx, dy, dz, 0, numx, numy, numz, sample, isovalue,
+                             g, num_attributes, vertices, polygons, attributes, snap_tolerance, workspace);
+}
+
+template<Decomposition decomposition = Decomposition::six,
+         typename vector3, typename formula, typename attribute_formula>
+void marching_cubes(const vector3& lower, const vector3& upper,
+    int numx, int numy, int numz, formula f, double isovalue,
+    attribute_formula g, int num_attributes,
+    std::vector<double>& vertices, std::vector<typename vector3::size_type>& polygons,
+    std::vector<double>& attributes, double snap_tolerance = 0.0)
+{
+    Workspace workspace;
+    marching_cubes<decomposition>(lower, upper, numx, numy, numz, f, isovalue, g, num_attributes,
+                   vertices, polygons, attributes, snap_tolerance, workspace);
 }
 
 template<typename vector3, typename formula>
@@ -24,6 +620,28 @@ void marching_cubes(const vector3& lower, const vector3& upper,
     std::vector<double>& vertices, std::vector<typename vector3::size_type>& polygons)
 {
     using coord_type = typename vector3::value_type;
+
+    std::vector<double> attributes;
+    auto no_attributes = [](coord_type, coord_type, coord_type, double*) {};
+    marching_cubes(lower, upper, numx, numy, numz, f, isovalue, no_attributes, 0,
+                   vertices, polygons, attributes);
+}
+
+/*
+    Version of marching_cubes for samples already computed on the grid: sample(i, j, k) must
+    return the value at the grid point (i, j, k), which is at lower + (i*dx, j*dy, k*dz). The cells
+    are split in num_threads slabs along x that are marched in parallel (sample must be
+    thread-safe), each one with its own vertex map. The slabs are then joined in order, looking up
+    the vertices of every slab in the map of the previous one, so the mesh is the same as the one
+    of marching_cubes, including the numbering of the vertices
+*/
+template<Decomposition decomposition = Decomposition::six, typename vector3, typename sampler>
+void marching_cubes_grid(const vector3& lower, const vector3& upper,
+    int numx, int numy, int numz, sampler sample, double isovalue,
+    std::vector<double>& vertices, std::vector<typename vector3::size_type>& polygons,
+    double snap_tolerance = 0.0, int num_threads = 1)
+{
+    using coord_type = typename vector3::value_type;
     using size_type = typename vector3::size_type;
     using namespace private_;
 
@@ -35,101 +653,474 @@ void marching_cubes(const vector3& lower, const vector3& upper,
                    [](double a, double b)->bool {return a <= b;}))
         return;
 
-    // numx, numy and numz are the numbers of evaluations in each direction
+    // Numbers of cells in each direction
     --numx; --numy; --numz;
 
     coord_type dx = (upper[0] - lower[0]) / static_cast<coord_type>(numx);
     coord_type dy = (upper[1] - lower[1]) / static_cast<coord_type>(numy);
     coord_type dz = (upper[2] - lower[2]) / static_cast<coord_type>(numz);
 
-    // Generate the 3D data structure where the triangles of each cell will be stored
-	// NOTE: This is done for finding the shells
-	auto triangles = new std::vector<Triangle*>***[numx];
-	for (int i = 0; i < numx; i++)
-	{
-		triangles[i] = new std::vector<Triangle*>**[numy];
-		for (int j = 0; j < numy; j++)
-		{
-			triangles[i][j] = new std::vector<Triangle*>*[numz];
-		}
-	}
+    struct Slab
+    {
+        std::vector<double> vertices;
+        std::vector<size_type> polygons;
+        Workspace workspace;
+    };
+    std::vector<Slab> slabs(std::max(1, std::min(num_threads, numx)));
+    auto no_attributes = [](coord_type, coord_type, coord_type, double*) {};
+    parallelRanges(numx, static_cast<int>(slabs.size()), [&](int first, int last, int range) {
+        std::vector<double> attributes;
+        Slab& slab = slabs[range];
+        marchSlab<decomposition>(lower, dx, dy, dz, first, last, numy, numz, sample, isovalue,
+                                 no_attributes, 0, slab.vertices, slab.polygons, attributes,
+                                 snap_tolerance, slab.workspace);
+    });
 
-    for(int i=0; i<numx; ++i)
+    // Index in the mesh of the vertices of the previous slab and of the current one
+    std::vector<size_type> previous_ids, ids;
+    size_type num_vertices = vertices.size() / 3;
+    for(size_t s = 0; s < slabs.size(); ++s)
     {
-        coord_type x = lower[0] + dx*i;
-        coord_type x_dx = lower[0] + dx*(i+1);
+        const Slab& slab = slabs[s];
+        size_t count = slab.vertices.size() / 3;
+        ids.resize(count);
+        for(size_t v = 0; v < count; ++v)
+        {
+            const double* p = &slab.vertices[3 * v];
 
-        for(int j=0; j<numy; ++j)
+            // The vertices shared with the previous slab were found there first
+            int previous = -1;
+            if(s > 0)
+                previous = slabs[s - 1].workspace.vertex_map.find(Vector3(p[0], p[2], p[1])); // swap y z
+            if(previous >= 0)
+            {
+                ids[v] = previous_ids[previous];
+                continue;
+            }
+
+            ids[v] = num_vertices++;
+            vertices.insert(vertices.end(), p, p + 3);
+        }
+
+        for(auto id : slab.polygons)
+            polygons.push_back(ids[id]);
+        previous_ids.swap(ids);
+    }
+}
+
+/*
+    Adaptive version of marching_cubes for implicit functions. The grid of numx * numy * numz
+    points is covered by an octree of blocks, and f is only evaluated at the corners of the blocks
+    that may be crossed by the isosurface, down to the cells of the grid (the target cell size).
+    If lipschitz is positive, it must be an upper bound of the Lipschitz constant of f, and blocks
+    whose corners are all farther from the isovalue than the bound allows are discarded: no
+    crossed cell is missed. Otherwise blocks of up to 8 cells without a sign change at their
+    corners are discarded, which may miss features smaller than a block.
+
+    The surface is then followed across the faces of the crossed cells, so every extracted
+    component is closed. Since all the leaves are marched at the finest level there are no
+    cracks between refinement levels, and when every crossed cell is found the result is the
+    same as the one of marching_cubes with the same decomposition.
+    @return The number of evaluations of f
+*/
+template<Decomposition decomposition = Decomposition::six, typename vector3, typename formula>
+size_t marching_cubes_adaptive(const vector3& lower, const vector3& upper,
+    int numx, int numy, int numz, formula f, double isovalue, double lipschitz,
+    std::vector<double>& vertices, std::vector<typename vector3::size_type>& polygons,
+    double snap_tolerance = 0.0)
+{
+    using coord_type = typename vector3::value_type;
+    using namespace private_;
+
+    // Some initial checks
+    if(numx < 2 || numy < 2 || numz < 2)
+        return 0;
+
+    if(!std::equal(std::begin(lower), std::end(lower), std::begin(upper),
+                   [](double a, double b)->bool {return a <= b;}))
+        return 0;
+
+    // Numbers of cells in each direction
+    int cellsx = numx - 1, cellsy = numy - 1, cellsz = numz - 1;
+
+    coord_type dx = (upper[0] - lower[0]) / static_cast<coord_type>(cellsx);
+    coord_type dy = (upper[1] - lower[1]) / static_cast<coord_type>(cellsy);
+    coord_type dz = (upper[2] - lower[2]) / static_cast<coord_type>(cellsz);
+
+    // Memoized evaluations of f at the grid points (same coordinates as marching_cubes)
+    std::unordered_map<size_t, double> samples;
+    auto sample = [&](int i, int j, int k) -> double {
+        size_t key = (static_cast<size_t>(i) * numy + j) * numz + k;
+        auto it = samples.find(key);
+        if(it != samples.end())
+            return it->second;
+
+        double value = f(lower[0] + dx*i, lower[1] + dy*j, lower[2] + dz*k);
+        samples[key] = value;
+        return value;
+    };
+
+    // Values of the corners of the cell (i, j, k), in the order expected by marchCell
+    auto cell_values = [&](int i, int j, int k, double* v) -> bool {
+        v[0] = sample(i, j, k);     v[1] = sample(i+1, j, k);
+        v[2] = sample(i+1, j+1, k); v[3] = sample(i, j+1, k);
+        v[4] = sample(i, j, k+1);   v[5] = sample(i+1, j, k+1);
+        v[6] = sample(i+1, j+1, k+1); v[7] = sample(i, j+1, k+1);
+
+        bool positive = false, negative = false;
+        for(int c = 0; c < 8; ++c)
         {
-            coord_type y = lower[1] + dy*j;
-            coord_type y_dy = lower[1] + dy*(j+1);
+            positive |= v[c] > isovalue;
+            negative |= v[c] <= isovalue;
+        }
+        return positive && negative;
+    };
+
+    auto cell_index = [&](int i, int j, int k) -> size_t {
+        return (static_cast<size_t>(i) * cellsy + j) * cellsz + k;
+    };
 
+    // Cells crossed by the isosurface
+    std::unordered_set<size_t> visited;
+    std::vector<std::array<int, 3>> crossed;
+
+    // Refines the block of size cells starting at cell (i, j, k), clipped to the grid
+    std::function<void(int, int, int, int)> refine = [&](int i, int j, int k, int size) {
+        if(i >= cellsx || j >= cellsy || k >= cellsz)
+            return;
+
+        if(size == 1)
+        {
             double v[8];
-            v[4] = f(x, y, lower[2]); v[5] = f(x_dx, y, lower[2]);
-            v[6] = f(x_dx, y_dy, lower[2]); v[7] = f(x, y_dy, lower[2]);
+            if(visited.insert(cell_index(i, j, k)).second && cell_values(i, j, k, v))
+                crossed.push_back({i, j, k});
+            return;
+        }
 
-            for(int k=0; k<numz; ++k)
+        int i1 = std::min(i + size, cellsx);
+        int j1 = std::min(j + size, cellsy);
+        int k1 = std::min(k + size, cellsz);
+
+        double v[8] = {sample(i, j, k), sample(i1, j, k), sample(i1, j1, k), sample(i, j1, k),
+                       sample(i, j, k1), sample(i1, j, k1), sample(i1, j1, k1), sample(i, j1, k1)};
+
+        bool positive = false, negative = false;
+        double distance = HUGE_VAL;
+        for(int c = 0; c < 8; ++c)
+        {
+            positive |= v[c] > isovalue;
+            negative |= v[c] <= isovalue;
+            distance = std::min(distance, std::abs(v[c] - isovalue));
+        }
+
+        if(!(positive && negative))
+        {
+            // Every point of the block is closer than half its diagonal to one of the corners
+            if(lipschitz <= 0.0)
+                return;
+            double half_diagonal = 0.5 * std::sqrt(std::pow(dx * (i1 - i), 2) +
+                                                   std::pow(dy * (j1 - j), 2) +
+                                                   std::pow(dz * (k1 - k), 2));
+            if(distance > lipschitz * half_diagonal)
+                return;
+        }
+
+        int half = size / 2;
+        for(int c = 0; c < 8; ++c)
+            refine(i + (c & 1 ? half : 0), j + (c & 2 ? half : 0), k + (c & 4 ? half : 0), half);
+    };
+
+    // Root blocks: the whole grid with a Lipschitz bound, blocks of 8 cells otherwise
+    int max_cells = std::max(cellsx, std::max(cellsy, cellsz));
+    int block = 1;
+    while(block < max_cells && (lipschitz > 0.0 || block < 8))
+        block *= 2;
+    for(int i = 0; i < cellsx; i += block)
+        for(int j = 0; j < cellsy; j += block)
+            for(int k = 0; k < cellsz; k += block)
+                refine(i, j, k, block);
+
+    // Follow the surface through the faces of the crossed cells
+    for(size_t n = 0; n < crossed.size(); ++n)
+    {
+        const int i = crossed[n][0], j = crossed[n][1], k = crossed[n][2];
+        const int neighbors[6][3] = {{i-1, j, k}, {i+1, j, k}, {i, j-1, k},
+                                     {i, j+1, k}, {i, j, k-1}, {i, j, k+1}};
+        for(auto& c : neighbors)
+        {
+            if(c[0] < 0 || c[1] < 0 || c[2] < 0 || c[0] >= cellsx || c[1] >= cellsy || c[2] >= cellsz)
+                continue;
+
+            double v[8];
+            if(visited.insert(cell_index(c[0], c[1], c[2])).second && cell_values(c[0], c[1], c[2], v))
+                crossed.push_back({c[0], c[1], c[2]});
+        }
+    }
+
+    // March the crossed cells in the order of marching_cubes so the vertices are numbered alike
+    std::sort(crossed.begin(), crossed.end());
+
+    std::vector<double> attributes;
+    auto no_attributes = [](coord_type, coord_type, coord_type, double*) {};
+    std::vector<Triangle> triangles;
+    VertexMap vertex_map;
+    for(auto& c : crossed)
+    {
+        const int i = c[0], j = c[1], k = c[2];
+        double v[8];
+        cell_values(i, j, k, v);
+
+        triangles.clear();
+        marchCell<decomposition>(lower[0] + dx*i, lower[0] + dx*(i+1),
+                  lower[1] + dy*j, lower[1] + dy*(j+1),
+                  lower[2] + dz*k, lower[2] + dz*(k+1),
+                  v, isovalue, no_attributes, 0, nullptr, snap_tolerance, triangles, (i + j + k) & 1);
+        addTriangles(triangles, vertex_map, vertices, polygons, attributes, 0, nullptr);
+    }
+
+    return samples.size();
+}
+
+/*
+    First pass of the two-pass extraction. Evaluates f at every grid point, keeping only whether
+    it is above, on or below the isovalue, and counts from these states the vertices of every row
+    of grid points and the triangles of every slab of cells along x. Their prefix sums are stored
+    in counts, so the total size of the mesh is known before building it and every slab can be
+    written in parallel at its own offset. The grid is split in num_threads slabs (f must be
+    thread-safe when num_threads > 1).
+
+    The mesh has one vertex per cut edge of the tetrahedra, except for the cut edges ending at a
+    grid point on the isovalue, which share the vertex at that point, and the triangles collapsed
+    to such a point are dropped. It is the mesh of marching_cubes with the same decomposition,
+    with the vertices numbered by edge, up to the vertices marching_cubes merges because they are
+    closer than its tolerance. The decomposition is kept in counts for write_mesh
+*/
+template<Decomposition decomposition = Decomposition::six, typename vector3, typename formula>
+void count_mesh(const vector3& lower, const vector3& upper,
+    int numx, int numy, int numz, formula f, double isovalue,
+    MeshCounts& counts, int num_threads = 1)
+{
+    using coord_type = typename vector3::value_type;
+    using namespace private_;
+
+    // Reset the counts keeping their storage, so repeated extractions do not allocate memory
+    counts.numx = counts.numy = counts.numz = 0;
+    counts.decomposition = decomposition;
+    counts.row_vertices.assign(1, 0);
+    counts.slab_triangles.assign(1, 0);
+
+    // Some initial checks
+    if(numx < 2 || numy < 2 || numz < 2)
+        return;
+
+    if(!std::equal(std::begin(lower), std::end(lower), std::begin(upper),
+                   [](double a, double b)->bool {return a <= b;}))
+        return;
+
+    counts.numx = numx; counts.numy = numy; counts.numz = numz;
+
+    coord_type dx = (upper[0] - lower[0]) / static_cast<coord_type>(numx - 1);
+    coord_type dy = (upper[1] - lower[1]) / static_cast<coord_type>(numy - 1);
+    coord_type dz = (upper[2] - lower[2]) / static_cast<coord_type>(numz - 1);
+
+    // States of the grid points
+    counts.signs.resize(static_cast<size_t>(numx) * numy * numz);
+    parallelRanges(numx, num_threads, [&](int first, int last, int) {
+        for(int i=first; i<last; ++i)
+        {
+            coord_type x = lower[0] + dx*i;
+            for(int j=0; j<numy; ++j)
             {
-                coord_type z = lower[2] + dz*k;
-                coord_type z_dz = lower[2] + dz*(k+1);
+                coord_type y = lower[1] + dy*j;
+                unsigned char* row = &counts.signs[(static_cast<size_t>(i) * numy + j) * numz];
+                for(int k=0; k<numz; ++k)
+                    row[k] = pointState(f(x, y, lower[2] + dz*k), isovalue);
+            }
+        }
+    });
 
-                // 0-8: (---)(+--)(++-)(-+-)(--+)(+-+)(+++)(-++)
-                v[0] = v[4]; v[1] = v[5];
-                v[2] = v[6]; v[3] = v[7];
-                v[4] = f(x, y, z_dz); v[5] = f(x_dx, y, z_dz);
-                v[6] = f(x_dx, y_dy, z_dz); v[7] = f(x, y_dy, z_dz);
-
-                // 0-8: (---)(+--)(+-+)(--+)(-+-)(++-)(+++)(-++)
-                // swap y z
-                auto v0 = new Vector3(x, z, y);
-                auto v1 = new Vector3(x_dx, z, y);
-                auto v2 = new Vector3(x_dx, z, y_dy);
-                auto v3 = new Vector3(x, z, y_dy);
-                auto v4 = new Vector3(x, z_dz, y);
-                auto v5 = new Vector3(x_dx, z_dz, y);
-                auto v6 = new Vector3(x_dx, z_dz, y_dy);
-                auto v7 = new Vector3(x, z_dz, y_dy);
-
-                // Isovalue of each point
-                v0->info = v[0]; v1->info = v[1];
-                v2->info = v[2]; v3->info = v[3];
-                v4->info = v[4]; v5->info = v[5];
-                v6->info = v[6]; v7->info = v[7];
-
-                // March the cell's tetrahedra and store the triangles in the respective cell
-				triangles[i][j][k] = marchCellTetrahedra(v0, v1, v2, v3, v4, v5, v6, v7, isovalue);
+    // Vertices of every row and triangles of every slab
+    counts.row_vertices.assign(static_cast<size_t>(numx) * numy + 1, 0);
+    counts.slab_triangles.assign(numx, 0);
+    parallelRanges(numx, num_threads, [&](int first, int last, int) {
+        for(int i=first; i<last; ++i)
+        {
+            for(int j=0; j<numy; ++j)
+                counts.row_vertices[static_cast<size_t>(i) * numy + j + 1] = rowVertexIds(counts, i, j, nullptr);
+
+            if(i == numx - 1)
+                continue;
+
+            size_t triangles = 0;
+            for(int j=0; j<numy-1; ++j)
+            {
+                for(int k=0; k<numz-1; ++k)
+                {
+                    unsigned on;
+                    unsigned mask = cellMask(counts, i, j, k, on);
+                    bool odd = (i + j + k) & 1;
+                    triangles += cellTriangleCount(mask, decomposition, odd);
+                    if(on != 0)
+                        triangles -= cellPointTriangleCount(mask, on, decomposition, odd);
+                }
             }
+            counts.slab_triangles[i + 1] = triangles;
         }
-    }
+    });
 
-    // Hash map to record the index
-    std::unordered_map<Vector3, int, Vector3Hash> vertex_map;
-    int current_id = -1;
+    std::partial_sum(counts.row_vertices.begin(), counts.row_vertices.end(), counts.row_vertices.begin());
+    std::partial_sum(counts.slab_triangles.begin(), counts.slab_triangles.end(), counts.slab_triangles.begin());
+}
 
-    // Lambda to add a new vertex to both the list and hash map
-    auto add_vertex = [&](Vector3* v) -> int {
-        if (vertex_map.find({v->x, v->y, v->z}) == vertex_map.end()) {
-            vertices.push_back(v->x);
-            vertices.push_back(v->z); // swap y z back
-            vertices.push_back(v->y);
-            vertex_map[{v->x, v->y, v->z}] = ++current_id;
-            return current_id;
-        } else {
-            return vertex_map[{v->x, v->y, v->z}];
+/*
+    Second pass of the two-pass extraction. Writes the counts.num_vertices() vertices (three
+    coordinates each) and counts.num_triangles() triangles (three indices each) of the mesh to the
+    given buffers, which must be large enough. Indices are stored as index_type. f, lower, upper
+    and isovalue must be the ones given to count_mesh. f is evaluated again only at the ends of the
+    cut edges and at the corners of the cells crossed by the isosurface. The rows of vertices and
+    the slabs of triangles are written in parallel at the offsets of counts. Only the scratch
+    space of counts is modified
+*/
+template<typename vector3, typename formula, typename index_type>
+void write_mesh(const vector3& lower, const vector3& upper, formula f, double isovalue,
+    MeshCounts& counts, double* vertices, index_type* polygons, int num_threads = 1)
+{
+    using coord_type = typename vector3::value_type;
+    using namespace private_;
+
+    const int numx = counts.numx, numy = counts.numy, numz = counts.numz;
+    if(numx < 2)
+        return;
+
+    coord_type dx = (upper[0] - lower[0]) / static_cast<coord_type>(numx - 1);
+    coord_type dy = (upper[1] - lower[1]) / static_cast<coord_type>(numy - 1);
+    coord_type dz = (upper[2] - lower[2]) / static_cast<coord_type>(numz - 1);
+
+    // Vertices: the slots of every row in the order numbered by rowVertexIds
+    parallelRanges(numx, num_threads, [&](int first, int last, int) {
+        for(int i=first; i<last; ++i)
+        {
+            for(int j=0; j<numy; ++j)
+            {
+                size_t id = counts.row_vertices[static_cast<size_t>(i) * numy + j];
+                if(id == counts.row_vertices[static_cast<size_t>(i) * numy + j + 1])
+                    continue;
+
+                for(int k=0; k<numz; ++k)
+                {
+                    unsigned mask = vertexMask(counts, i, j, k);
+                    for(int s=0; mask != 0; ++s, mask >>= 1)
+                    {
+                        if(!(mask & 1))
+                            continue;
+
+                        coord_type x0 = lower[0] + dx*i, y0 = lower[1] + dy*j, z0 = lower[2] + dz*k;
+                        if(s == pointSlot)
+                        {
+                            vertices[3 * id] = x0;
+                            vertices[3 * id + 1] = y0;
+                            vertices[3 * id + 2] = z0;
+                            ++id;
+                            continue;
+                        }
+
+                        const int* direction = edgeDirections[s];
+                        int i1 = i + direction[0], j1 = j + direction[1], k1 = k + direction[2];
+                        coord_type x1 = lower[0] + dx*i1, y1 = lower[1] + dy*j1, z1 = lower[2] + dz*k1;
+                        double t = inverseLinearInterpolation(isovalue, f(x0, y0, z0), f(x1, y1, z1), 0.0);
+                        vertices[3 * id] = x0 + t * (x1 - x0);
+                        vertices[3 * id + 1] = y0 + t * (y1 - y0);
+                        vertices[3 * id + 2] = z0 + t * (z1 - z0);
+                        ++id;
+                    }
+                }
+            }
         }
-    };
+    });
+
+    // Triangles: the cells of every slab in the order of marching_cubes
+    const size_t row_size = vertexSlots * static_cast<size_t>(numz);
+    counts.edge_ids.resize(4 * row_size * std::max(1, std::min(num_threads, numx - 1)));
+    parallelRanges(numx - 1, num_threads, [&](int first, int last, int range) {
+        // Indices of the vertices attached to the rows (i, j), (i, j+1), (i+1, j) and (i+1, j+1)
+        size_t* ids[4];
+        for(int r=0; r<4; ++r)
+            ids[r] = &counts.edge_ids[(4 * static_cast<size_t>(range) + r) * row_size];
+
+        for(int i=first; i<last; ++i)
+        {
+            index_type* out = polygons + 3 * counts.slab_triangles[i];
+            rowVertexIds(counts, i, 0, ids[1]);
+            rowVertexIds(counts, i + 1, 0, ids[3]);
 
-    for (int i = 0; i < numx; i++) {
-		for (int j = 0; j < numy; j++) {
-		    for (int k = 0; k < numz; k++) {
-                for (auto& tri : *triangles[i][j][k]) {
-                    polygons.push_back(add_vertex(tri->v0));
-                    polygons.push_back(add_vertex(tri->v2));
-                    polygons.push_back(add_vertex(tri->v1));
+            for(int j=0; j<numy-1; ++j)
+            {
+                std::swap(ids[0], ids[1]);
+                std::swap(ids[2], ids[3]);
+                rowVertexIds(counts, i, j + 1, ids[1]);
+                rowVertexIds(counts, i + 1, j + 1, ids[3]);
+
+                for(int k=0; k<numz-1; ++k)
+                {
+                    unsigned on;
+                    unsigned mask = cellMask(counts, i, j, k, on);
+                    if(mask == 0 || mask == 255)
+                        continue;
+
+                    double position[8][3], value[8];
+                    for(int c=0; c<8; ++c)
+                    {
+                        coord_type x = lower[0] + dx*(i + cellCorners[c][0]);
+                        coord_type y = lower[1] + dy*(j + cellCorners[c][1]);
+                        coord_type z = lower[2] + dz*(k + cellCorners[c][2]);
+                        position[c][0] = x; position[c][1] = y; position[c][2] = z;
+                        value[c] = f(x, y, z);
+                    }
+
+                    for(auto& tetrahedron : cellSplit(counts.decomposition, (i + j + k) & 1))
+                    {
+                        int edges[2][3][2], order[4];
+                        int num_triangles = tetrahedronTriangles(tetrahedron, mask, edges, order);
+                        if(num_triangles == 0)
+                            continue;
+
+                        // The corner farthest from the isovalue orients the triangles as in marching_cubes
+                        int reference = order[0];
+                        for(int c=1; c<4; ++c)
+                            if(std::abs(value[order[c]] - isovalue) > std::abs(value[reference] - isovalue))
+                                reference = order[c];
+                        bool positive = value[reference] > isovalue;
+
+                        for(int t=0; t<num_triangles; ++t)
+                        {
+                            index_type v[3];
+                            for(int e=0; e<3; ++e)
+                            {
+                                int corner, slot;
+                                edgeVertex(edges[t][e][0], edges[t][e][1], on, corner, slot);
+                                const int* offset = cellCorners[corner];
+                                v[e] = ids[2 * offset[0] + offset[1]][vertexSlots * (k + offset[2]) + slot];
+                            }
+
+                            // Triangles collapsed to a grid point on the isovalue
+                            if(v[0] == v[1] && v[1] == v[2])
+                                continue;
+
+                            const double* p0 = vertices + 3 * v[0];
+                            const double* p1 = vertices + 3 * v[1];
+                            const double* p2 = vertices + 3 * v[2];
+                            Vector3 A(p0[0], p0[1], p0[2]), B(p1[0], p1[1], p1[2]), C(p2[0], p2[1], p2[2]);
+                            Vector3 R(position[reference][0], position[reference][1], position[reference][2]);
+                            if(swapOrientation(A, B, C, R, positive))
+                                std::swap(v[1], v[2]);
+
+                            *out++ = v[0]; *out++ = v[1]; *out++ = v[2];
+                        }
+                    }
                 }
-		    }
-		}
-	}
+            }
+        }
+    });
 }
 
 }
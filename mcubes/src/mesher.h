@@ -0,0 +1,149 @@
+
+#ifndef _MESHER_H
+#define _MESHER_H
+
+#include <stddef.h>
+#include <array>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "marchingcubes.h"
+
+namespace mc
+{
+
+/*
+    Extracts the isosurfaces of volumes of a fixed shape with the two-pass extraction (see
+    count_mesh and write_mesh). The counts and scratch buffers are kept between extractions, so
+    once they have grown to the largest mesh, extracting into buffers provided by the caller does
+    not allocate memory (when num_threads is 1; more threads are started on every pass).
+
+    The volumes are contiguous arrays of numx * numy * numz doubles indexed as
+    volume[(x * numy + y) * numz + z]. Every call to write uses the counts of the last call to
+    count, so callers sharing a mesher among threads must hold mutex() from count to write.
+*/
+class Mesher
+{
+public:
+
+    /*
+        Constructor of the class
+        @param numx, numy, numz The shape of the volumes
+        @param num_threads The number of threads of the passes. If it is not positive, the number
+        of hardware threads is used
+        @param decomposition The split of the cells into tetrahedra
+    */
+    Mesher(int numx, int numy, int numz, int num_threads = 1, Decomposition decomposition = Decomposition::six)
+        : numx(numx), numy(numy), numz(numz), num_threads(num_threads), decomposition(decomposition),
+          volume(nullptr), isovalue(0.0) {
+        if (numx < 2 || numy < 2 || numz < 2)
+        {
+            throw std::runtime_error("the volume must have at least two samples in each direction");
+        }
+        if (num_threads <= 0)
+        {
+            this->num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+    }
+
+    /*
+        Returns the shape of the volumes
+    */
+    std::array<int, 3> shape() const {
+        return {{numx, numy, numz}};
+    }
+
+    /*
+        First pass on a volume: counts the vertices and triangles of its isosurface. The volume
+        must be alive until the call to write
+    */
+    void count(const double* volume, double isovalue) {
+        this->volume = volume;
+        this->isovalue = isovalue;
+        if (decomposition == Decomposition::five)
+        {
+            count_mesh<Decomposition::five>(lower(), upper(), numx, numy, numz, sampler(), isovalue, counts,
+                                            num_threads);
+        }
+        else
+        {
+            count_mesh<Decomposition::six>(lower(), upper(), numx, numy, numz, sampler(), isovalue, counts,
+                                           num_threads);
+        }
+    }
+
+    /*
+        Returns the number of vertices of the last counted isosurface
+    */
+    size_t num_vertices() const {
+        return counts.num_vertices();
+    }
+
+    /*
+        Returns the number of triangles of the last counted isosurface
+    */
+    size_t num_triangles() const {
+        return counts.num_triangles();
+    }
+
+    /*
+        Second pass on the last counted volume: writes num_vertices() vertices (three coordinates
+        each) and num_triangles() triangles (three indices each) to the given buffers
+    */
+    template<typename index_type>
+    void write(double* vertices, index_type* polygons) {
+        if (volume == nullptr)
+        {
+            throw std::runtime_error("count must be called before write");
+        }
+        write_mesh(lower(), upper(), sampler(), isovalue, counts, vertices, polygons, num_threads);
+    }
+
+    /*
+        Returns the lock that serializes the extractions of the threads sharing the mesher
+    */
+    std::mutex& mutex() {
+        return lock;
+    }
+
+private:
+
+    int numx, numy, numz;
+    int num_threads;
+    Decomposition decomposition;
+
+    // The volume and isovalue of the last call to count
+    const double* volume;
+    double isovalue;
+
+    MeshCounts counts;
+
+    std::mutex lock;
+
+    std::array<long, 3> lower() const {
+        return {{0, 0, 0}};
+    }
+
+    std::array<long, 3> upper() const {
+        return {{numx - 1L, numy - 1L, numz - 1L}};
+    }
+
+    // Function giving the samples of a volume
+    struct Sampler
+    {
+        const double* volume;
+        long numy, numz;
+
+        double operator()(long x, long y, long z) const {
+            return volume[(x * numy + y) * numz + z];
+        }
+    };
+
+    Sampler sampler() const {
+        return Sampler{volume, numy, numz};
+    }
+};
+
+}
+
+#endif // _MESHER_H
@@ -0,0 +1,99 @@
+
+#ifndef _PYRAMID_H
+#define _PYRAMID_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <array>
+#include "marchingcubes.h"
+
+namespace mc
+{
+
+/*
+    Reduction of the samples of a volume pyramid:
+        mean: average with weights (1, 2, 1) / 4 along every axis
+        min, max: minimum or maximum, so the parts of the volume below (or above) the isovalue
+        never vanish in the coarse levels
+*/
+enum class PyramidMode
+{
+    mean,
+    min,
+    max
+};
+
+/*
+    Returns the shape of the next level of a pyramid. The sample i of the next level lies on the
+    sample 2 * i of the current one, so the coarse grid spans the same box (up to one sample when
+    the size is even)
+*/
+inline std::array<int, 3> downsampled_shape(const std::array<int, 3>& shape)
+{
+    return {{(shape[0] - 1) / 2 + 1, (shape[1] - 1) / 2 + 1, (shape[2] - 1) / 2 + 1}};
+}
+
+/*
+    Computes the next level of a pyramid. Every coarse sample reduces the 3x3x3 fine samples
+    around it (clamped to the volume), so together they cover all the fine samples
+    @param volume The current level, indexed as volume[(x * numy + y) * numz + z]
+    @param shape The shape of the current level
+    @param out Buffer for the next level, with the shape given by downsampled_shape
+*/
+inline void downsample(const double* volume, const std::array<int, 3>& shape, PyramidMode mode,
+                       double* out, int num_threads = 1)
+{
+    const std::array<int, 3> coarse = downsampled_shape(shape);
+    const double weights[3] = {0.25, 0.5, 0.25};
+
+    private_::parallelRanges(coarse[0], num_threads, [&](int first, int last, int) {
+        for (int i = first; i < last; ++i)
+        {
+            for (int j = 0; j < coarse[1]; ++j)
+            {
+                for (int k = 0; k < coarse[2]; ++k)
+                {
+                    double sum = 0.0;
+                    double weight = 0.0;
+                    double extremum = volume[(2L * i * shape[1] + 2 * j) * shape[2] + 2 * k];
+                    for (int di = -1; di <= 1; ++di)
+                    {
+                        int x = 2 * i + di;
+                        if (x < 0 || x >= shape[0])
+                        {
+                            continue;
+                        }
+                        for (int dj = -1; dj <= 1; ++dj)
+                        {
+                            int y = 2 * j + dj;
+                            if (y < 0 || y >= shape[1])
+                            {
+                                continue;
+                            }
+                            const double* row = &volume[(static_cast<size_t>(x) * shape[1] + y) * shape[2]];
+                            for (int dk = -1; dk <= 1; ++dk)
+                            {
+                                int z = 2 * k + dk;
+                                if (z < 0 || z >= shape[2])
+                                {
+                                    continue;
+                                }
+                                double w = weights[di + 1] * weights[dj + 1] * weights[dk + 1];
+                                sum += w * row[z];
+                                weight += w;
+                                extremum = mode == PyramidMode::min ? std::min(extremum, row[z])
+                                                                    : std::max(extremum, row[z]);
+                            }
+                        }
+                    }
+                    out[(static_cast<size_t>(i) * coarse[1] + j) * coarse[2] + k] =
+                        mode == PyramidMode::mean ? sum / weight : extremum;
+                }
+            }
+        }
+    });
+}
+
+}
+
+#endif // _PYRAMID_H
@@ -2,20 +2,205 @@
 #include "pywrapper.h"
 
 #include "marchingcubes.h"
+#include "decimation.h"
+#include "vertexcache.h"
+#include "compact.h"
+#include "pyramid.h"
+#include "ThreadPool.h"
 
 #include <stdexcept>
 #include <array>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <string.h>
 
+namespace
+{
 
-PyObject* marching_cubes_func(PyObject* lower, PyObject* upper,
-    int numx, int numy, int numz, PyObject* pyfunc, double isovalue)
+// Copies the content of a std::vector to a new one-dimensional ndarray
+template<typename T, typename npy_type>
+PyArrayObject* vector_to_ndarray(const std::vector<T>& values, int typenum)
 {
-    std::vector<double> vertices;
-    std::vector<size_t> polygons;
+    npy_intp size = values.size();
+    PyArrayObject* arr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &size, typenum));
 
-    // Copy the lower and upper coordinates to a C array.
-    std::array<double,3> lower_;
-    std::array<double,3> upper_;
+    // Same representation: copy the whole buffer at once
+    if(std::is_same<T, npy_type>::value ||
+       (std::is_integral<T>::value && std::is_integral<npy_type>::value && sizeof(T) == sizeof(npy_type) &&
+        std::is_signed<T>::value == std::is_signed<npy_type>::value))
+    {
+        if(size > 0)
+            memcpy(PyArray_DATA(arr), values.data(), size * sizeof(T));
+        return arr;
+    }
+
+    typename std::vector<T>::const_iterator it = values.begin();
+    for(int i=0; it!=values.end(); ++i, ++it)
+        *reinterpret_cast<npy_type*>(PyArray_GETPTR1(arr, i)) = *it;
+
+    return arr;
+}
+
+// Adds the ACMR before and after the vertex cache optimization to the info dict
+void set_acmr(PyObject* info, double acmr_before, double acmr_after)
+{
+    PyObject* value = PyFloat_FromDouble(acmr_before);
+    PyDict_SetItemString(info, "acmr_before", value);
+    Py_DECREF(value);
+    value = PyFloat_FromDouble(acmr_after);
+    PyDict_SetItemString(info, "acmr_after", value);
+    Py_DECREF(value);
+}
+
+// Runs the optional stages on the extracted mesh and packs the result into the tuple
+// (vertices, polygons, attributes, labels, info). The attributes are returned channel by channel
+// and info is a dict with the statistics of the stages
+PyObject* build_result(std::vector<double>& vertices, std::vector<size_t>& polygons,
+    std::vector<double>& attributes, size_t num_attributes, const ExtractionOptions& options)
+{
+    PyObject* info = PyDict_New();
+
+    // Removal of degenerate triangles.
+    if(options.cleanup)
+    {
+        size_t removed = mc::remove_degenerate_triangles(vertices, polygons, attributes, num_attributes,
+                                                         options.tolerance);
+        PyObject* value = PyLong_FromSize_t(removed);
+        PyDict_SetItemString(info, "removed_triangles", value);
+        Py_DECREF(value);
+    }
+
+    // Shell labelling and filtering.
+    std::vector<size_t> labels;
+    if(options.return_labels || options.min_triangles > 0 || options.keep_largest)
+    {
+        mc::label_components(polygons, vertices.size() / 3, labels);
+        mc::filter_components(vertices, polygons, labels, attributes, num_attributes,
+                              options.min_triangles, options.keep_largest);
+    }
+    if(!options.return_labels)
+        labels.clear();
+
+    // Vertex cache optimization.
+    if(options.cache_size > 0)
+    {
+        double acmr_before, acmr_after;
+        mc::optimize_vertex_cache(vertices, polygons, attributes, num_attributes, labels,
+                                  options.cache_size, acmr_before, acmr_after);
+        set_acmr(info, acmr_before, acmr_after);
+    }
+
+    // Store the attributes channel by channel so every channel is contiguous.
+    std::vector<double> channels(attributes.size());
+    size_t num_vertices = vertices.size() / 3;
+    for(size_t i=0; i<num_vertices; ++i)
+        for(size_t a=0; a<num_attributes; ++a)
+            channels[a * num_vertices + i] = attributes[i * num_attributes + a];
+
+    // Copy the result to Python ndarrays.
+    PyArrayObject* verticesarr = vector_to_ndarray<double, double>(vertices, NPY_DOUBLE);
+    PyArrayObject* polygonsarr = vector_to_ndarray<size_t, unsigned long>(polygons, NPY_ULONG);
+    PyArrayObject* attributesarr = vector_to_ndarray<double, double>(channels, NPY_DOUBLE);
+    PyArrayObject* labelsarr = vector_to_ndarray<size_t, unsigned long>(labels, NPY_ULONG);
+
+    PyObject* res = Py_BuildValue("(O,O,O,O,O)", verticesarr, polygonsarr, attributesarr, labelsarr, info);
+    Py_XDECREF(verticesarr);
+    Py_XDECREF(polygonsarr);
+    Py_XDECREF(attributesarr);
+    Py_XDECREF(labelsarr);
+    Py_XDECREF(info);
+    return res;
+}
+
+// Pool shared by the batched extractions, started on first use
+ThreadPool& batch_pool()
+{
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+// Runs mc::count_mesh with the given decomposition
+template<typename vector3, typename formula>
+void count_mesh(mc::Decomposition decomposition, const vector3& lower, const vector3& upper,
+                int numx, int numy, int numz, formula f, double isovalue, mc::MeshCounts& counts, int num_threads)
+{
+    if(decomposition == mc::Decomposition::five)
+        mc::count_mesh<mc::Decomposition::five>(lower, upper, numx, numy, numz, f, isovalue, counts, num_threads);
+    else
+        mc::count_mesh<mc::Decomposition::six>(lower, upper, numx, numy, numz, f, isovalue, counts, num_threads);
+}
+
+// First pass of the two-pass extraction of a contiguous volume of doubles
+void count_volume(PyArrayObject* arr, double isovalue, int num_threads, mc::Decomposition decomposition,
+                  mc::MeshCounts& counts)
+{
+    if(PyArray_NDIM(arr) != 3 || PyArray_TYPE(arr) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(arr))
+        throw std::runtime_error("volume must be a contiguous three-dimensional array of doubles");
+
+    npy_intp* shape = PyArray_DIMS(arr);
+    const double* data = reinterpret_cast<const double*>(PyArray_DATA(arr));
+    std::array<long, 3> lower{0, 0, 0};
+    std::array<long, 3> upper{shape[0]-1, shape[1]-1, shape[2]-1};
+    const long numy = shape[1], numz = shape[2];
+    auto array_to_cfunc = [&](long x, long y, long z) -> double {
+        return data[(x * numy + y) * numz + z];
+    };
+
+    if(num_threads <= 0)
+        num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        count_mesh(decomposition, lower, upper, shape[0], shape[1], shape[2], array_to_cfunc, isovalue, counts,
+                   num_threads);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+        std::rethrow_exception(error);
+}
+
+// Returns a new reference to the output buffer out, checking that it is made of rows of three
+// values and can hold size values, or a new array of size values if out is None. If grow is set,
+// a new array is also returned when out is too small. Invalid buffers raise std::invalid_argument
+// (ValueError in Python)
+PyArrayObject* output_buffer(PyObject* out, npy_intp size, int typenum, bool grow, const char* error)
+{
+    if(out != Py_None)
+    {
+        if(!PyArray_Check(out))
+            throw std::invalid_argument(error);
+        PyArrayObject* arr = reinterpret_cast<PyArrayObject*>(out);
+        if(PyArray_TYPE(arr) != typenum || !PyArray_IS_C_CONTIGUOUS(arr) || !PyArray_ISWRITEABLE(arr) ||
+           PyArray_SIZE(arr) % 3 != 0)
+            throw std::invalid_argument(error);
+        if(PyArray_SIZE(arr) >= size)
+        {
+            Py_INCREF(out);
+            return arr;
+        }
+        if(!grow)
+            throw std::invalid_argument(error);
+    }
+
+    PyObject* arr = PyArray_SimpleNew(1, &size, typenum);
+    if(arr == NULL)
+        throw std::bad_alloc();
+    return reinterpret_cast<PyArrayObject*>(arr);
+}
+
+// Copies the lower and upper coordinates of the grid to C arrays
+void copy_bounds(PyObject* lower, PyObject* upper, std::array<double,3>& lower_, std::array<double,3>& upper_)
+{
     for(int i=0; i<3; ++i)
     {
         PyObject* l = PySequence_GetItem(lower, i);
@@ -39,6 +224,53 @@ PyObject* marching_cubes_func(PyObject* lower, PyObject* upper,
                 throw std::runtime_error("unknown error");
         }
     }
+}
+
+// Runs mc::marching_cubes with the decomposition and snap tolerance of the options
+template<typename vector3, typename formula, typename attribute_formula>
+void extract(const vector3& lower, const vector3& upper, int numx, int numy, int numz,
+             formula f, double isovalue, attribute_formula g, int num_attributes,
+             std::vector<double>& vertices, std::vector<size_t>& polygons,
+             std::vector<double>& attributes, const ExtractionOptions& options)
+{
+    double snap = options.cleanup ? options.tolerance : 0.0;
+    if(options.decomposition == 5)
+        mc::marching_cubes<mc::Decomposition::five>(lower, upper, numx, numy, numz, f, isovalue,
+                                                    g, num_attributes, vertices, polygons, attributes, snap);
+    else
+        mc::marching_cubes<mc::Decomposition::six>(lower, upper, numx, numy, numz, f, isovalue,
+                                                   g, num_attributes, vertices, polygons, attributes, snap);
+}
+
+// Runs mc::marching_cubes_adaptive with the decomposition and snap tolerance of the options
+template<typename vector3, typename formula>
+size_t extract_adaptive(const vector3& lower, const vector3& upper, int numx, int numy, int numz,
+                        formula f, double isovalue, double lipschitz,
+                        std::vector<double>& vertices, std::vector<size_t>& polygons,
+                        const ExtractionOptions& options)
+{
+    double snap = options.cleanup ? options.tolerance : 0.0;
+    if(options.decomposition == 5)
+        return mc::marching_cubes_adaptive<mc::Decomposition::five>(lower, upper, numx, numy, numz, f, isovalue,
+                                                                    lipschitz, vertices, polygons, snap);
+    return mc::marching_cubes_adaptive<mc::Decomposition::six>(lower, upper, numx, numy, numz, f, isovalue,
+                                                               lipschitz, vertices, polygons, snap);
+}
+
+}
+
+
+PyObject* marching_cubes_func(PyObject* lower, PyObject* upper,
+    int numx, int numy, int numz, PyObject* pyfunc, double isovalue,
+    const ExtractionOptions& options)
+{
+    std::vector<double> vertices;
+    std::vector<size_t> polygons;
+
+    // Copy the lower and upper coordinates to a C array.
+    std::array<double,3> lower_;
+    std::array<double,3> upper_;
+    copy_bounds(lower, upper, lower_, upper_);
 
     auto pyfunc_to_cfunc = [&](double x, double y, double z) -> double {
         PyObject* res = PyObject_CallFunction(pyfunc, "(d,d,d)", x, y, z);
@@ -51,33 +283,180 @@ PyObject* marching_cubes_func(PyObject* lower, PyObject* upper,
     };
 
     // Marching cubes.
-    mc::marching_cubes(lower_, upper_, numx, numy, numz, pyfunc_to_cfunc, isovalue, vertices, polygons);
+    std::vector<double> attributes;
+    auto no_attributes = [](double, double, double, double*) {};
+    extract(lower_, upper_, numx, numy, numz, pyfunc_to_cfunc, isovalue,
+            no_attributes, 0, vertices, polygons, attributes, options);
 
-    // Copy the result to two Python ndarrays.
-    npy_intp size_vertices = vertices.size();
-    npy_intp size_polygons = polygons.size();
-    PyArrayObject* verticesarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &size_vertices, NPY_DOUBLE));
-    PyArrayObject* polygonsarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &size_polygons, NPY_ULONG));
+    return build_result(vertices, polygons, attributes, 0, options);
+}
 
-    std::vector<double>::const_iterator it = vertices.begin();
-    for(int i=0; it!=vertices.end(); ++i, ++it)
-        *reinterpret_cast<double*>(PyArray_GETPTR1(verticesarr, i)) = *it;
-    std::vector<size_t>::const_iterator it2 = polygons.begin();
-    for(int i=0; it2!=polygons.end(); ++i, ++it2)
-        *reinterpret_cast<unsigned long*>(PyArray_GETPTR1(polygonsarr, i)) = *it2;
 
-    PyObject* res = Py_BuildValue("(O,O)", verticesarr, polygonsarr);
-    Py_XDECREF(verticesarr);
-    Py_XDECREF(polygonsarr);
+PyObject* marching_cubes_cfunc(PyObject* lower, PyObject* upper,
+    int numx, int numy, int numz, size_t function, size_t user_data, double isovalue,
+    int num_threads, const ExtractionOptions& options)
+{
+    std::vector<double> vertices;
+    std::vector<size_t> polygons;
+    std::vector<double> attributes;
+
+    std::array<double,3> lower_;
+    std::array<double,3> upper_;
+    copy_bounds(lower, upper, lower_, upper_);
+
+    native_function cfunc = reinterpret_cast<native_function>(function);
+    void* cdata = reinterpret_cast<void*>(user_data);
+
+    if(num_threads <= 0)
+        num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    // Same sample coordinates as mc::marching_cubes.
+    double dx = (upper_[0] - lower_[0]) / (numx - 1);
+    double dy = (upper_[1] - lower_[1]) / (numy - 1);
+    double dz = (upper_[2] - lower_[2]) / (numz - 1);
+
+    std::vector<double> samples;
+    auto buffer_to_cfunc = [&](int i, int j, int k) -> double {
+        return samples[(static_cast<size_t>(i) * numy + j) * numz + k];
+    };
+    double snap = options.cleanup ? options.tolerance : 0.0;
+
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        // Evaluate every sample of the grid once, splitting the x slabs among the threads.
+        samples.resize(static_cast<size_t>(numx) * numy * numz);
+        mc::private_::parallelRanges(numx, num_threads, [&](int first, int last, int) {
+            for(int i=first; i<last; ++i)
+            {
+                double x = lower_[0] + dx*i;
+                for(int j=0; j<numy; ++j)
+                {
+                    double y = lower_[1] + dy*j;
+                    double* row = &samples[(static_cast<size_t>(i) * numy + j) * numz];
+                    for(int k=0; k<numz; ++k)
+                        row[k] = cfunc(x, y, lower_[2] + dz*k, cdata);
+                }
+            }
+        });
+
+        // Marching cubes, also split among the threads.
+        if(options.decomposition == 5)
+            mc::marching_cubes_grid<mc::Decomposition::five>(lower_, upper_, numx, numy, numz, buffer_to_cfunc,
+                                                             isovalue, vertices, polygons, snap, num_threads);
+        else
+            mc::marching_cubes_grid<mc::Decomposition::six>(lower_, upper_, numx, numy, numz, buffer_to_cfunc,
+                                                            isovalue, vertices, polygons, snap, num_threads);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+        std::rethrow_exception(error);
+
+    return build_result(vertices, polygons, attributes, 0, options);
+}
+
+
+PyObject* marching_cubes_adaptive(PyObject* lower, PyObject* upper,
+    int numx, int numy, int numz, PyObject* pyfunc, size_t function, size_t user_data,
+    double isovalue, double lipschitz, const ExtractionOptions& options)
+{
+    std::vector<double> vertices;
+    std::vector<size_t> polygons;
+    std::vector<double> attributes;
+
+    std::array<double,3> lower_;
+    std::array<double,3> upper_;
+    copy_bounds(lower, upper, lower_, upper_);
+
+    size_t evaluations = 0;
+
+    if(function != 0)
+    {
+        // Native functions are evaluated without the GIL.
+        native_function cfunc = reinterpret_cast<native_function>(function);
+        void* cdata = reinterpret_cast<void*>(user_data);
+        auto native_to_cfunc = [&](double x, double y, double z) -> double {
+            return cfunc(x, y, z, cdata);
+        };
+
+        std::exception_ptr error;
+        Py_BEGIN_ALLOW_THREADS
+        try
+        {
+            evaluations = extract_adaptive(lower_, upper_, numx, numy, numz, native_to_cfunc,
+                                           isovalue, lipschitz, vertices, polygons, options);
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+        Py_END_ALLOW_THREADS
+        if(error)
+            std::rethrow_exception(error);
+    }
+    else
+    {
+        auto pyfunc_to_cfunc = [&](double x, double y, double z) -> double {
+            PyObject* res = PyObject_CallFunction(pyfunc, "(d,d,d)", x, y, z);
+            if(res == NULL)
+                return 0.0;
+
+            double result = PyFloat_AsDouble(res);
+            Py_DECREF(res);
+            return result;
+        };
+
+        evaluations = extract_adaptive(lower_, upper_, numx, numy, numz, pyfunc_to_cfunc,
+                                       isovalue, lipschitz, vertices, polygons, options);
+    }
+
+    PyObject* res = build_result(vertices, polygons, attributes, 0, options);
+
+    // Add the evaluation counts to the info dict.
+    PyObject* info = PyTuple_GET_ITEM(res, 4);
+    size_t dense = static_cast<size_t>(numx) * numy * numz;
+    PyObject* value = PyLong_FromSize_t(evaluations);
+    PyDict_SetItemString(info, "evaluations", value);
+    Py_DECREF(value);
+    value = PyLong_FromSize_t(dense - evaluations);
+    PyDict_SetItemString(info, "saved_evaluations", value);
+    Py_DECREF(value);
+
     return res;
 }
 
 
-PyObject* marching_cubes(PyArrayObject* arr, double isovalue)
+PyObject* marching_cubes(PyArrayObject* arr, double isovalue, PyObject* attributes,
+    const ExtractionOptions& options)
 {
     if(PyArray_NDIM(arr) != 3)
         throw std::runtime_error("Only three-dimensional arrays are supported.");
 
+    // Auxiliary volumes to be interpolated at the vertices (borrowed references).
+    std::vector<PyArrayObject*> attrarrs;
+    Py_ssize_t num_attributes = PySequence_Size(attributes);
+    if(num_attributes < 0)
+        throw std::runtime_error("attributes must be a sequence of arrays");
+    for(Py_ssize_t a=0; a<num_attributes; ++a)
+    {
+        PyObject* item = PySequence_GetItem(attributes, a);
+        if(item == NULL)
+            throw std::runtime_error("attributes must be a sequence of arrays");
+        Py_DECREF(item); // The sequence keeps the item alive.
+
+        if(!PyArray_Check(item))
+            throw std::runtime_error("attributes must be a sequence of arrays");
+        PyArrayObject* attrarr = reinterpret_cast<PyArrayObject*>(item);
+        if(!PyArray_SAMESHAPE(attrarr, arr))
+            throw std::runtime_error("attributes must have the same shape as the volume");
+        attrarrs.push_back(attrarr);
+    }
+
     // Prepare data.
     npy_intp* shape = PyArray_DIMS(arr);
     std::array<long, 3> lower{0, 0, 0};
@@ -88,31 +467,748 @@ PyObject* marching_cubes(PyArrayObject* arr, double isovalue)
     std::vector<double> vertices;
     std::vector<size_t> polygons;
 
+    std::vector<double> vertex_attributes;
+
     auto pyarray_to_cfunc = [&](long x, long y, long z) -> double {
         const npy_intp c[3] = {x, y, z};
         return PyArray_SafeGet<double>(arr, c);
     };
 
+    auto pyarrays_to_cattributes = [&](long x, long y, long z, double* out) {
+        const npy_intp c[3] = {x, y, z};
+        for(size_t a=0; a<attrarrs.size(); ++a)
+            out[a] = PyArray_SafeGet<double>(attrarrs[a], c);
+    };
+
     // Marching cubes.
-    mc::marching_cubes(lower, upper, numx, numy, numz, pyarray_to_cfunc, isovalue,
-                        vertices, polygons);
-
-    // Copy the result to two Python ndarrays.
-    npy_intp size_vertices = vertices.size();
-    npy_intp size_polygons = polygons.size();
-    PyArrayObject* verticesarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &size_vertices, NPY_DOUBLE));
-    PyArrayObject* polygonsarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &size_polygons, NPY_ULONG));
-
-    std::vector<double>::const_iterator it = vertices.begin();
-    for(int i=0; it!=vertices.end(); ++i, ++it)
-        *reinterpret_cast<double*>(PyArray_GETPTR1(verticesarr, i)) = *it;
-    std::vector<size_t>::const_iterator it2 = polygons.begin();
-    for(int i=0; it2!=polygons.end(); ++i, ++it2)
-        *reinterpret_cast<unsigned long*>(PyArray_GETPTR1(polygonsarr, i)) = *it2;
+    extract(lower, upper, numx, numy, numz, pyarray_to_cfunc, isovalue,
+            pyarrays_to_cattributes, static_cast<int>(num_attributes),
+            vertices, polygons, vertex_attributes, options);
+
+    return build_result(vertices, polygons, vertex_attributes, num_attributes, options);
+}
+
+
+PyObject* marching_cubes_count(PyArrayObject* arr, double isovalue, int num_threads,
+    mc::Decomposition decomposition)
+{
+    mc::MeshCounts counts;
+    count_volume(arr, isovalue, num_threads, decomposition, counts);
+    return Py_BuildValue("(n,n)", static_cast<Py_ssize_t>(counts.num_vertices()),
+                         static_cast<Py_ssize_t>(counts.num_triangles()));
+}
+
+
+PyObject* marching_cubes_exact(PyArrayObject* arr, double isovalue,
+    PyObject* out_vertices, PyObject* out_faces, int num_threads, mc::Decomposition decomposition)
+{
+    // First pass: sizes of the mesh.
+    mc::MeshCounts counts;
+    count_volume(arr, isovalue, num_threads, decomposition, counts);
+    size_t num_vertices = counts.num_vertices();
+    size_t num_triangles = counts.num_triangles();
+
+    PyArrayObject* verticesarr = output_buffer(out_vertices, 3 * num_vertices, NPY_DOUBLE, false,
+        "out_vertices must be a contiguous writeable array of doubles of shape (N, 3) with room for the vertices");
+    PyArrayObject* polygonsarr;
+    try
+    {
+        polygonsarr = output_buffer(out_faces, 3 * num_triangles, NPY_ULONG, false,
+            "out_faces must be a contiguous writeable array of unsigned longs of shape (M, 3) with room for the faces");
+    }
+    catch(...)
+    {
+        Py_DECREF(verticesarr);
+        throw;
+    }
+
+    // Second pass: write the mesh in place.
+    npy_intp* shape = PyArray_DIMS(arr);
+    const double* data = reinterpret_cast<const double*>(PyArray_DATA(arr));
+    std::array<long, 3> lower{0, 0, 0};
+    std::array<long, 3> upper{shape[0]-1, shape[1]-1, shape[2]-1};
+    const long numy = shape[1], numz = shape[2];
+    auto array_to_cfunc = [&](long x, long y, long z) -> double {
+        return data[(x * numy + y) * numz + z];
+    };
+    double* vertices = reinterpret_cast<double*>(PyArray_DATA(verticesarr));
+    if(num_threads <= 0)
+        num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    unsigned long* polygons = reinterpret_cast<unsigned long*>(PyArray_DATA(polygonsarr));
+
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        mc::write_mesh(lower, upper, array_to_cfunc, isovalue, counts, vertices, polygons, num_threads);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+    {
+        Py_DECREF(verticesarr);
+        Py_DECREF(polygonsarr);
+        std::rethrow_exception(error);
+    }
+
+    PyObject* res = Py_BuildValue("(O,O,n,n)", verticesarr, polygonsarr,
+                                  static_cast<Py_ssize_t>(num_vertices), static_cast<Py_ssize_t>(num_triangles));
+    Py_XDECREF(verticesarr);
+    Py_XDECREF(polygonsarr);
+    return res;
+}
+
+
+PyObject* marching_cubes_lod(PyArrayObject* arr, double isovalue, int levels, int mode, int num_threads,
+    mc::Decomposition decomposition)
+{
+    if(PyArray_NDIM(arr) != 3 || PyArray_TYPE(arr) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(arr))
+        throw std::runtime_error("volume must be a contiguous three-dimensional array of doubles");
+    if(num_threads <= 0)
+        num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    npy_intp* dims = PyArray_DIMS(arr);
+    std::array<int, 3> shape{{static_cast<int>(dims[0]), static_cast<int>(dims[1]), static_cast<int>(dims[2])}};
+    const double* data = reinterpret_cast<const double*>(PyArray_DATA(arr));
+
+    // Storage of the current coarse level and of the next one
+    std::vector<double> current, next;
+    mc::MeshCounts counts;
+    PyObject* result = PyList_New(0);
+
+    for(int level=0; level<levels; ++level)
+    {
+        std::array<int, 3> coarse = mc::downsampled_shape(shape);
+        bool has_next = level + 1 < levels && coarse[0] >= 2 && coarse[1] >= 2 && coarse[2] >= 2;
+        if(has_next)
+            next.resize(static_cast<size_t>(coarse[0]) * coarse[1] * coarse[2]);
+
+        std::array<long, 3> lower{0, 0, 0};
+        std::array<long, 3> upper{shape[0]-1L, shape[1]-1L, shape[2]-1L};
+        const long numy = shape[1], numz = shape[2];
+        auto array_to_cfunc = [&](long x, long y, long z) -> double {
+            return data[(x * numy + y) * numz + z];
+        };
+
+        // The next level is built in its own thread while this one is extracted.
+        std::thread builder;
+        std::exception_ptr error;
+        Py_BEGIN_ALLOW_THREADS
+        try
+        {
+            if(has_next)
+                builder = std::thread([&]() {
+                    mc::downsample(data, shape, static_cast<mc::PyramidMode>(mode), next.data());
+                });
+            count_mesh(decomposition, lower, upper, shape[0], shape[1], shape[2], array_to_cfunc, isovalue, counts,
+                       num_threads);
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+            if(builder.joinable())
+                builder.join();
+        }
+        Py_END_ALLOW_THREADS
+        if(error)
+        {
+            Py_DECREF(result);
+            std::rethrow_exception(error);
+        }
+
+        npy_intp num_vertices = 3 * counts.num_vertices();
+        npy_intp num_triangles = 3 * counts.num_triangles();
+        PyArrayObject* verticesarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &num_vertices, NPY_DOUBLE));
+        PyArrayObject* polygonsarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &num_triangles, NPY_ULONG));
+        if(verticesarr == NULL || polygonsarr == NULL)
+        {
+            Py_XDECREF(verticesarr);
+            Py_XDECREF(polygonsarr);
+            if(builder.joinable())
+                builder.join();
+            Py_DECREF(result);
+            throw std::bad_alloc();
+        }
+        double* vertices = reinterpret_cast<double*>(PyArray_DATA(verticesarr));
+        unsigned long* polygons = reinterpret_cast<unsigned long*>(PyArray_DATA(polygonsarr));
+
+        Py_BEGIN_ALLOW_THREADS
+        try
+        {
+            mc::write_mesh(lower, upper, array_to_cfunc, isovalue, counts, vertices, polygons, num_threads);
+
+            // Back to the coordinates of the full resolution volume
+            const double scale = static_cast<double>(1L << level);
+            for(npy_intp i=0; i<num_vertices; ++i)
+                vertices[i] *= scale;
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+        if(builder.joinable())
+            builder.join();
+        Py_END_ALLOW_THREADS
+
+        PyObject* mesh = Py_BuildValue("(O,O)", verticesarr, polygonsarr);
+        Py_XDECREF(verticesarr);
+        Py_XDECREF(polygonsarr);
+        PyList_Append(result, mesh);
+        Py_XDECREF(mesh);
+        if(error)
+        {
+            Py_DECREF(result);
+            std::rethrow_exception(error);
+        }
+
+        if(!has_next)
+            break;
+        current.swap(next);
+        data = current.data();
+        shape = coarse;
+    }
+
+    return result;
+}
+
+
+PyObject* mesher_extract(mc::Mesher& mesher, PyArrayObject* volume, double isovalue,
+    PyObject* out_vertices, PyObject* out_faces)
+{
+    std::array<int, 3> shape = mesher.shape();
+    if(PyArray_NDIM(volume) != 3 || PyArray_TYPE(volume) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(volume) ||
+       PyArray_DIM(volume, 0) != shape[0] || PyArray_DIM(volume, 1) != shape[1] || PyArray_DIM(volume, 2) != shape[2])
+        throw std::runtime_error("volume must be a contiguous array of doubles with the shape of the mesher");
+
+    // The counts of the mesher are used from count to write, so other threads calling the same
+    // mesher wait until this extraction ends. The lock is only taken with the GIL released, so
+    // a thread holding it can always get the GIL back.
+    std::unique_lock<std::mutex> lock(mesher.mutex(), std::defer_lock);
+    const double* data = reinterpret_cast<const double*>(PyArray_DATA(volume));
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    lock.lock();
+    try
+    {
+        mesher.count(data, isovalue);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+        std::rethrow_exception(error);
+
+    size_t num_vertices = mesher.num_vertices();
+    size_t num_triangles = mesher.num_triangles();
+    // Write into the given buffers when they are large enough
+    PyArrayObject* verticesarr = output_buffer(out_vertices, 3 * num_vertices, NPY_DOUBLE, true,
+        "out_vertices must be a contiguous writeable array of doubles of shape (N, 3)");
+    PyArrayObject* polygonsarr;
+    try
+    {
+        polygonsarr = output_buffer(out_faces, 3 * num_triangles, NPY_ULONG, true,
+            "out_faces must be a contiguous writeable array of unsigned longs of shape (M, 3)");
+    }
+    catch(...)
+    {
+        Py_DECREF(verticesarr);
+        throw;
+    }
+
+    double* vertices = reinterpret_cast<double*>(PyArray_DATA(verticesarr));
+    unsigned long* polygons = reinterpret_cast<unsigned long*>(PyArray_DATA(polygonsarr));
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        mesher.write(vertices, polygons);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    lock.unlock();
+    Py_END_ALLOW_THREADS
+    if(error)
+    {
+        Py_DECREF(verticesarr);
+        Py_DECREF(polygonsarr);
+        std::rethrow_exception(error);
+    }
+
+    PyObject* res = Py_BuildValue("(O,O,n,n)", verticesarr, polygonsarr,
+                                  static_cast<Py_ssize_t>(num_vertices), static_cast<Py_ssize_t>(num_triangles));
+    Py_XDECREF(verticesarr);
+    Py_XDECREF(polygonsarr);
+    return res;
+}
+
+
+PyObject* series_extract(mc::TimeSeriesMesher& mesher, PyArrayObject* volume, double isovalue)
+{
+    std::array<int, 3> shape = mesher.shape();
+    if(PyArray_NDIM(volume) != 3 || PyArray_TYPE(volume) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(volume) ||
+       PyArray_DIM(volume, 0) != shape[0] || PyArray_DIM(volume, 1) != shape[1] || PyArray_DIM(volume, 2) != shape[2])
+        throw std::runtime_error("frames must be contiguous arrays of doubles with the same shape");
+
+    const double* data = reinterpret_cast<const double*>(PyArray_DATA(volume));
+    std::vector<double> vertices;
+    std::vector<size_t> polygons;
+    size_t marched = 0;
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        marched = mesher.extract(data, isovalue, vertices, polygons);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+        std::rethrow_exception(error);
+
+    PyArrayObject* verticesarr = vector_to_ndarray<double, double>(vertices, NPY_DOUBLE);
+    PyArrayObject* polygonsarr = vector_to_ndarray<size_t, unsigned long>(polygons, NPY_ULONG);
+    PyObject* res = Py_BuildValue("(O,O,n)", verticesarr, polygonsarr, static_cast<Py_ssize_t>(marched));
+    Py_XDECREF(verticesarr);
+    Py_XDECREF(polygonsarr);
+    return res;
+}
+
+
+PyObject* marching_cubes_series(PyArrayObject* frames, double isovalue, int brick_size, int num_threads,
+    mc::Decomposition decomposition)
+{
+    if(PyArray_NDIM(frames) != 4 || PyArray_TYPE(frames) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(frames))
+        throw std::runtime_error("frames must be a contiguous four-dimensional array of doubles");
+    if(num_threads <= 0)
+        num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    npy_intp* shape = PyArray_DIMS(frames);
+    const int num_frames = static_cast<int>(shape[0]);
+    const size_t frame_size = static_cast<size_t>(shape[1]) * shape[2] * shape[3];
+    const double* data = reinterpret_cast<const double*>(PyArray_DATA(frames));
+
+    // The frames are split into runs of consecutive frames extracted in parallel, each one with
+    // its own mesher. The remaining threads split the bricks of every frame.
+    const int num_runs = std::max(1, std::min(num_threads, num_frames));
+    const int run_threads = std::max(1, num_threads / num_runs);
+    std::vector<std::vector<double>> vertices(num_frames);
+    std::vector<std::vector<size_t>> polygons(num_frames);
+    std::vector<size_t> marched(num_frames);
+    std::vector<std::exception_ptr> errors(num_runs);
+
+    Py_BEGIN_ALLOW_THREADS
+    mc::private_::parallelRanges(num_frames, num_runs, [&](int first, int last, int run) {
+        try
+        {
+            mc::TimeSeriesMesher mesher(shape[1], shape[2], shape[3], brick_size, run_threads, decomposition);
+            for(int t=first; t<last; ++t)
+                marched[t] = mesher.extract(data + t * frame_size, isovalue, vertices[t], polygons[t]);
+        }
+        catch(...)
+        {
+            errors[run] = std::current_exception();
+        }
+    });
+    Py_END_ALLOW_THREADS
+    for(auto& error : errors)
+        if(error)
+            std::rethrow_exception(error);
+
+    PyObject* result = PyList_New(num_frames);
+    for(int t=0; t<num_frames; ++t)
+    {
+        PyArrayObject* verticesarr = vector_to_ndarray<double, double>(vertices[t], NPY_DOUBLE);
+        PyArrayObject* polygonsarr = vector_to_ndarray<size_t, unsigned long>(polygons[t], NPY_ULONG);
+        PyList_SET_ITEM(result, t, Py_BuildValue("(O,O,n)", verticesarr, polygonsarr,
+                                                 static_cast<Py_ssize_t>(marched[t])));
+        Py_XDECREF(verticesarr);
+        Py_XDECREF(polygonsarr);
+        std::vector<double>().swap(vertices[t]);
+        std::vector<size_t>().swap(polygons[t]);
+    }
+    return result;
+}
+
+
+PyObject* chunked_add_block(mc::ChunkedMesher& mesher, PyArrayObject* block, PyObject* offset, double isovalue)
+{
+    if(PyArray_NDIM(block) != 3 || PyArray_TYPE(block) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(block))
+        throw std::runtime_error("block must be a contiguous three-dimensional array of doubles");
+
+    std::array<long, 3> offset_;
+    for(int i=0; i<3; ++i)
+    {
+        PyObject* o = PySequence_GetItem(offset, i);
+        if(o == NULL)
+            throw std::runtime_error("len(offset) < 3");
+        offset_[i] = PyLong_AsLong(o);
+        Py_DECREF(o);
+        if(offset_[i] == -1 && PyErr_Occurred())
+            throw std::runtime_error("offset must contain integers");
+    }
+
+    npy_intp* shape = PyArray_DIMS(block);
+    const double* data = reinterpret_cast<const double*>(PyArray_DATA(block));
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        mesher.add_block(data, shape[0], shape[1], shape[2], offset_, isovalue);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+        std::rethrow_exception(error);
+
+    Py_RETURN_NONE;
+}
+
+
+PyObject* chunked_result(mc::ChunkedMesher& mesher)
+{
+    PyArrayObject* verticesarr = vector_to_ndarray<double, double>(mesher.get_vertices(), NPY_DOUBLE);
+    PyArrayObject* polygonsarr = vector_to_ndarray<size_t, unsigned long>(mesher.get_polygons(), NPY_ULONG);
+
+    PyObject* res = Py_BuildValue("(O,O)", verticesarr, polygonsarr);
+    Py_XDECREF(verticesarr);
+    Py_XDECREF(polygonsarr);
+    return res;
+}
+
+
+PyObject* marching_cubes_batch(PyObject* volumes, PyArrayObject* isovalues, int num_threads,
+    mc::Decomposition decomposition)
+{
+    if(PyArray_TYPE(isovalues) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(isovalues))
+        throw std::runtime_error("isovalues must be a contiguous array of doubles");
+
+    Py_ssize_t num_volumes = PySequence_Size(volumes);
+    if(num_volumes < 0)
+        throw std::runtime_error("volumes must be a sequence of arrays");
+    if(PyArray_SIZE(isovalues) != num_volumes)
+        throw std::runtime_error("there must be one isovalue per volume");
+
+    // Data and shape of the volumes (borrowed from the sequence).
+    struct Volume
+    {
+        const double* data;
+        std::array<long, 3> upper;
+    };
+    std::vector<Volume> inputs(num_volumes);
+    for(Py_ssize_t n=0; n<num_volumes; ++n)
+    {
+        PyObject* item = PySequence_GetItem(volumes, n);
+        if(item == NULL)
+            throw std::runtime_error("volumes must be a sequence of arrays");
+        Py_DECREF(item); // The sequence keeps the item alive.
+
+        if(!PyArray_Check(item))
+            throw std::runtime_error("volumes must be a sequence of arrays");
+        PyArrayObject* arr = reinterpret_cast<PyArrayObject*>(item);
+        if(PyArray_NDIM(arr) != 3 || PyArray_TYPE(arr) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(arr))
+            throw std::runtime_error("volumes must be contiguous three-dimensional arrays of doubles");
+
+        npy_intp* shape = PyArray_DIMS(arr);
+        inputs[n].data = reinterpret_cast<const double*>(PyArray_DATA(arr));
+        inputs[n].upper = {shape[0]-1, shape[1]-1, shape[2]-1};
+    }
+    const double* isovalues_ = reinterpret_cast<const double*>(PyArray_DATA(isovalues));
+
+    // Every thread appends its meshes to its own buffers, which are gathered in order at the end.
+    ThreadPool& pool = batch_pool();
+    struct Output
+    {
+        std::vector<double> vertices;
+        std::vector<size_t> polygons;
+    };
+    struct Record
+    {
+        size_t worker;
+        size_t vertices_begin, vertices_end;
+        size_t polygons_begin, polygons_end;
+    };
+    std::vector<Output> outputs(pool.size());
+    std::vector<Record> records(num_volumes);
+
+    auto extract = [&](size_t worker, size_t n) {
+        // Workspaces outlive the call, so repeated batches reuse their buffers.
+        thread_local mc::Workspace workspace;
+
+        const Volume& volume = inputs[n];
+        const long numy = volume.upper[1] + 1, numz = volume.upper[2] + 1;
+        auto array_to_cfunc = [&](long x, long y, long z) -> double {
+            return volume.data[(x * numy + y) * numz + z];
+        };
+        auto no_attributes = [](long, long, long, double*) {};
+
+        Output& output = outputs[worker];
+        Record& record = records[n];
+        record.worker = worker;
+        record.vertices_begin = output.vertices.size();
+        record.polygons_begin = output.polygons.size();
+
+        std::vector<double> attributes;
+        std::array<long, 3> lower{0, 0, 0};
+        if(decomposition == mc::Decomposition::five)
+            mc::marching_cubes<mc::Decomposition::five>(lower, volume.upper, volume.upper[0] + 1, numy, numz,
+                array_to_cfunc, isovalues_[n], no_attributes, 0, output.vertices, output.polygons, attributes, 0.0,
+                workspace);
+        else
+            mc::marching_cubes<mc::Decomposition::six>(lower, volume.upper, volume.upper[0] + 1, numy, numz,
+                array_to_cfunc, isovalues_[n], no_attributes, 0, output.vertices, output.polygons, attributes, 0.0,
+                workspace);
+
+        record.vertices_end = output.vertices.size();
+        record.polygons_end = output.polygons.size();
+    };
+
+    // Offsets of every mesh in the concatenated buffers.
+    std::vector<npy_intp> vertex_offsets(num_volumes + 1, 0);
+    std::vector<npy_intp> face_offsets(num_volumes + 1, 0);
+
+    // Errors are rethrown once the GIL is held again.
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        pool.run(num_volumes, extract, std::max(num_threads, 0));
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+        std::rethrow_exception(error);
+
+    for(Py_ssize_t n=0; n<num_volumes; ++n)
+    {
+        const Record& record = records[n];
+        vertex_offsets[n+1] = vertex_offsets[n] + (record.vertices_end - record.vertices_begin) / 3;
+        face_offsets[n+1] = face_offsets[n] + (record.polygons_end - record.polygons_begin) / 3;
+    }
+
+    npy_intp num_vertex_values = 3 * vertex_offsets[num_volumes];
+    npy_intp num_polygon_values = 3 * face_offsets[num_volumes];
+    PyArrayObject* verticesarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &num_vertex_values, NPY_DOUBLE));
+    PyArrayObject* polygonsarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &num_polygon_values, NPY_ULONG));
+    if(verticesarr == NULL || polygonsarr == NULL)
+    {
+        Py_XDECREF(verticesarr);
+        Py_XDECREF(polygonsarr);
+        throw std::bad_alloc();
+    }
+    double* vertices_data = reinterpret_cast<double*>(PyArray_DATA(verticesarr));
+    unsigned long* polygons_data = reinterpret_cast<unsigned long*>(PyArray_DATA(polygonsarr));
+
+    // Gather the meshes in the order of the volumes. Faces keep the indices local to their mesh.
+    Py_BEGIN_ALLOW_THREADS
+    for(Py_ssize_t n=0; n<num_volumes; ++n)
+    {
+        const Record& record = records[n];
+        const Output& output = outputs[record.worker];
+        std::copy(output.vertices.begin() + record.vertices_begin, output.vertices.begin() + record.vertices_end,
+                  vertices_data + 3 * vertex_offsets[n]);
+        std::copy(output.polygons.begin() + record.polygons_begin, output.polygons.begin() + record.polygons_end,
+                  polygons_data + 3 * face_offsets[n]);
+    }
+    Py_END_ALLOW_THREADS
+
+    PyArrayObject* vertexoffsetsarr = vector_to_ndarray<npy_intp, npy_intp>(vertex_offsets, NPY_INTP);
+    PyArrayObject* faceoffsetsarr = vector_to_ndarray<npy_intp, npy_intp>(face_offsets, NPY_INTP);
+
+    PyObject* res = Py_BuildValue("(O,O,O,O)", verticesarr, polygonsarr, vertexoffsetsarr, faceoffsetsarr);
+    Py_XDECREF(verticesarr);
+    Py_XDECREF(polygonsarr);
+    Py_XDECREF(vertexoffsetsarr);
+    Py_XDECREF(faceoffsetsarr);
+    return res;
+}
+
+
+PyObject* decimate(PyArrayObject* vertices, PyArrayObject* faces,
+    size_t target_triangles, double max_error, int num_threads)
+{
+    if(PyArray_TYPE(vertices) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(vertices))
+        throw std::runtime_error("vertices must be a contiguous array of doubles");
+    if(PyArray_TYPE(faces) != NPY_ULONG || !PyArray_IS_C_CONTIGUOUS(faces))
+        throw std::runtime_error("faces must be a contiguous array of unsigned longs");
+
+    // Copy the mesh to C++ vectors.
+    const double* vertices_data = reinterpret_cast<const double*>(PyArray_DATA(vertices));
+    const unsigned long* faces_data = reinterpret_cast<const unsigned long*>(PyArray_DATA(faces));
+    std::vector<double> vertices_(vertices_data, vertices_data + PyArray_SIZE(vertices));
+    std::vector<size_t> polygons(faces_data, faces_data + PyArray_SIZE(faces));
+
+    size_t num_vertices = vertices_.size() / 3;
+    for(auto p : polygons)
+        if(p >= num_vertices)
+            throw std::runtime_error("faces reference vertices out of range");
+
+    // Decimation does not touch any Python object.
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        mc::decimate(vertices_, polygons, target_triangles, max_error, num_threads);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+        std::rethrow_exception(error);
+
+    PyArrayObject* verticesarr = vector_to_ndarray<double, double>(vertices_, NPY_DOUBLE);
+    PyArrayObject* polygonsarr = vector_to_ndarray<size_t, unsigned long>(polygons, NPY_ULONG);
 
     PyObject* res = Py_BuildValue("(O,O)", verticesarr, polygonsarr);
     Py_XDECREF(verticesarr);
     Py_XDECREF(polygonsarr);
+    return res;
+}
+
+
+PyObject* optimize_vertex_cache(PyArrayObject* vertices, PyArrayObject* faces, size_t cache_size)
+{
+    if(PyArray_TYPE(vertices) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(vertices))
+        throw std::runtime_error("vertices must be a contiguous array of doubles");
+    if(PyArray_TYPE(faces) != NPY_ULONG || !PyArray_IS_C_CONTIGUOUS(faces))
+        throw std::runtime_error("faces must be a contiguous array of unsigned longs");
+
+    const double* vertices_data = reinterpret_cast<const double*>(PyArray_DATA(vertices));
+    const unsigned long* faces_data = reinterpret_cast<const unsigned long*>(PyArray_DATA(faces));
+    std::vector<double> vertices_(vertices_data, vertices_data + PyArray_SIZE(vertices));
+    std::vector<size_t> polygons(faces_data, faces_data + PyArray_SIZE(faces));
+
+    size_t num_vertices = vertices_.size() / 3;
+    for(auto p : polygons)
+        if(p >= num_vertices)
+            throw std::runtime_error("faces reference vertices out of range");
+
+    std::vector<double> attributes;
+    std::vector<size_t> labels;
+    double acmr_before = 0.0, acmr_after = 0.0;
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        mc::optimize_vertex_cache(vertices_, polygons, attributes, 0, labels, cache_size, acmr_before, acmr_after);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+        std::rethrow_exception(error);
 
+    PyArrayObject* verticesarr = vector_to_ndarray<double, double>(vertices_, NPY_DOUBLE);
+    PyArrayObject* polygonsarr = vector_to_ndarray<size_t, unsigned long>(polygons, NPY_ULONG);
+    PyObject* info = PyDict_New();
+    set_acmr(info, acmr_before, acmr_after);
+
+    PyObject* res = Py_BuildValue("(O,O,O)", verticesarr, polygonsarr, info);
+    Py_XDECREF(verticesarr);
+    Py_XDECREF(polygonsarr);
+    Py_XDECREF(info);
+    return res;
+}
+
+
+PyObject* write_compact(PyArrayObject* vertices, PyArrayObject* faces, const char* filename,
+    PyObject* origin, PyObject* spacing, int bits, size_t block_size)
+{
+    if(PyArray_TYPE(vertices) != NPY_DOUBLE || !PyArray_IS_C_CONTIGUOUS(vertices))
+        throw std::runtime_error("vertices must be a contiguous array of doubles");
+    if(PyArray_TYPE(faces) != NPY_ULONG || !PyArray_IS_C_CONTIGUOUS(faces))
+        throw std::runtime_error("faces must be a contiguous array of unsigned longs");
+
+    mc::CompactFormat format;
+    copy_bounds(origin, spacing, format.origin, format.spacing);
+    format.bits = bits;
+    format.block_size = block_size;
+
+    const double* vertices_data = reinterpret_cast<const double*>(PyArray_DATA(vertices));
+    const unsigned long* faces_data = reinterpret_cast<const unsigned long*>(PyArray_DATA(faces));
+    size_t num_vertices = PyArray_SIZE(vertices) / 3;
+    size_t num_triangles = PyArray_SIZE(faces) / 3;
+
+    // The encoding streams the blocks to the file without touching Python objects.
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        mc::write_compact(filename, vertices_data, num_vertices, faces_data, num_triangles, format);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+        std::rethrow_exception(error);
+
+    Py_RETURN_NONE;
+}
+
+
+PyObject* read_compact(const char* filename, int num_threads)
+{
+    if(num_threads <= 0)
+        num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    mc::CompactReader reader(filename);
+
+    // The reader bounds the counts by the size of the file, but npy_intp may be narrower
+    if(reader.num_vertices() > static_cast<size_t>(NPY_MAX_INTP) / 3 ||
+       reader.num_triangles() > static_cast<size_t>(NPY_MAX_INTP) / 3)
+        throw std::runtime_error("compact mesh too large");
+    npy_intp num_vertices = 3 * static_cast<npy_intp>(reader.num_vertices());
+    npy_intp num_triangles = 3 * static_cast<npy_intp>(reader.num_triangles());
+    PyArrayObject* verticesarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &num_vertices, NPY_DOUBLE));
+    PyArrayObject* polygonsarr = reinterpret_cast<PyArrayObject*>(PyArray_SimpleNew(1, &num_triangles, NPY_ULONG));
+    if(verticesarr == NULL || polygonsarr == NULL)
+    {
+        Py_XDECREF(verticesarr);
+        Py_XDECREF(polygonsarr);
+        throw std::bad_alloc();
+    }
+    double* vertices = reinterpret_cast<double*>(PyArray_DATA(verticesarr));
+    unsigned long* polygons = reinterpret_cast<unsigned long*>(PyArray_DATA(polygonsarr));
+
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        reader.decode(vertices, polygons, num_threads);
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if(error)
+    {
+        Py_DECREF(verticesarr);
+        Py_DECREF(polygonsarr);
+        std::rethrow_exception(error);
+    }
+
+    PyObject* res = Py_BuildValue("(O,O)", verticesarr, polygonsarr);
+    Py_XDECREF(verticesarr);
+    Py_XDECREF(polygonsarr);
     return res;
 }
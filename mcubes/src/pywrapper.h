@@ -4,11 +4,71 @@
 
 #include <Python.h>
 #include "pyarraymodule.h"
+#include "mesher.h"
+#include "timeseries.h"
+#include "chunked.h"
 
 #include <vector>
 
-PyObject* marching_cubes(PyArrayObject* arr, double isovalue);
+// Optional stages applied to the mesh within the extraction call
+struct ExtractionOptions
+{
+    // Snap the vertices to the grid corners and remove the degenerate triangles
+    bool cleanup = false;
+
+    // Relative tolerance of the cleanup, with respect to the edge length
+    double tolerance = 1e-3;
+
+    // Compute the shell label of every triangle
+    bool return_labels = false;
+
+    // Drop the shells with less triangles than this
+    size_t min_triangles = 0;
+
+    // Keep only the shell with the most triangles
+    bool keep_largest = false;
+
+    // Reorder the mesh for a vertex cache of this size (0 to disable)
+    size_t cache_size = 0;
+
+    // Number of tetrahedra per cell, 6 or 5 (see mc::Decomposition)
+    int decomposition = 6;
+};
+
+// Signature of the native implicit functions, f(x, y, z, user_data)
+typedef double (*native_function)(double, double, double, void*);
+
+PyObject* marching_cubes(PyArrayObject* arr, double isovalue, PyObject* attributes,
+    const ExtractionOptions& options);
 PyObject* marching_cubes_func(PyObject* lower, PyObject* upper,
-    int numx, int numy, int numz, PyObject* f, double isovalue);
+    int numx, int numy, int numz, PyObject* f, double isovalue,
+    const ExtractionOptions& options);
+PyObject* marching_cubes_cfunc(PyObject* lower, PyObject* upper,
+    int numx, int numy, int numz, size_t function, size_t user_data, double isovalue,
+    int num_threads, const ExtractionOptions& options);
+PyObject* marching_cubes_adaptive(PyObject* lower, PyObject* upper,
+    int numx, int numy, int numz, PyObject* f, size_t function, size_t user_data,
+    double isovalue, double lipschitz, const ExtractionOptions& options);
+PyObject* marching_cubes_count(PyArrayObject* arr, double isovalue, int num_threads,
+    mc::Decomposition decomposition);
+PyObject* marching_cubes_exact(PyArrayObject* arr, double isovalue,
+    PyObject* out_vertices, PyObject* out_faces, int num_threads, mc::Decomposition decomposition);
+PyObject* marching_cubes_lod(PyArrayObject* arr, double isovalue, int levels, int mode, int num_threads,
+    mc::Decomposition decomposition);
+PyObject* mesher_extract(mc::Mesher& mesher, PyArrayObject* volume, double isovalue,
+    PyObject* out_vertices, PyObject* out_faces);
+PyObject* series_extract(mc::TimeSeriesMesher& mesher, PyArrayObject* volume, double isovalue);
+PyObject* marching_cubes_series(PyArrayObject* frames, double isovalue, int brick_size, int num_threads,
+    mc::Decomposition decomposition);
+PyObject* chunked_add_block(mc::ChunkedMesher& mesher, PyArrayObject* block, PyObject* offset, double isovalue);
+PyObject* chunked_result(mc::ChunkedMesher& mesher);
+PyObject* marching_cubes_batch(PyObject* volumes, PyArrayObject* isovalues, int num_threads,
+    mc::Decomposition decomposition);
+PyObject* decimate(PyArrayObject* vertices, PyArrayObject* faces,
+    size_t target_triangles, double max_error, int num_threads);
+PyObject* optimize_vertex_cache(PyArrayObject* vertices, PyArrayObject* faces, size_t cache_size);
+PyObject* write_compact(PyArrayObject* vertices, PyArrayObject* faces, const char* filename,
+    PyObject* origin, PyObject* spacing, int bits, size_t block_size);
+PyObject* read_compact(const char* filename, int num_threads);
 
 #endif // _PYWRAPPER_H
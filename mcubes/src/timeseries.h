@@ -0,0 +1,421 @@
+
+#ifndef _TIMESERIES_H
+#define _TIMESERIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "marchingcubes.h"
+
+namespace mc
+{
+
+/*
+    Extracts the isosurfaces of a sequence of volumes of a fixed shape (the frames of a time
+    series), reusing the work of the previous frame. The grid is split into bricks of brick_size
+    cells per axis. The triangles of a brick only depend on the states (above, on or below the
+    isovalue) of its grid points, so the bricks whose states did not change since the previous
+    frame keep their triangles and only the other bricks are marched again. The vertices are
+    interpolated again in every frame.
+
+    The meshes are the ones of the two-pass extraction (see count_mesh and write_mesh): the same
+    vertices in the same order, and the same triangles grouped by brick. The triangles with zero
+    area of the reused bricks keep the orientation of the frame they were marched in.
+
+    The volumes are contiguous arrays of numx * numy * numz doubles indexed as
+    volume[(x * numy + y) * numz + z].
+*/
+class TimeSeriesMesher
+{
+public:
+
+    /*
+        Constructor of the class
+        @param numx, numy, numz The shape of the volumes
+        @param brick_size The number of cells of the bricks along every axis
+        @param num_threads The number of threads of every extraction
+        @param decomposition The split of the cells into tetrahedra
+    */
+    TimeSeriesMesher(int numx, int numy, int numz, int brick_size = 16, int num_threads = 1,
+                     Decomposition decomposition = Decomposition::six)
+        : numx(numx), numy(numy), numz(numz), brick_size(brick_size), num_threads(std::max(1, num_threads)),
+          has_previous(false) {
+        if (numx < 2 || numy < 2 || numz < 2)
+        {
+            throw std::runtime_error("the volume must have at least two samples in each direction");
+        }
+        // The vertex slots of a brick are referenced with 32 bits, and the scratch buffers only
+        // need room for the largest brick, which may be smaller than brick_size along some axes
+        double brick_slots = static_cast<double>(private_::vertexSlots) * (std::min(brick_size, numx - 1) + 1) * (std::min(brick_size, numy - 1) + 1) *
+                             (std::min(brick_size, numz - 1) + 1);
+        if (brick_size < 1 || brick_slots >= 4294967296.0)
+        {
+            throw std::runtime_error("invalid brick size");
+        }
+
+        counts.numx = numx; counts.numy = numy; counts.numz = numz;
+        counts.decomposition = decomposition;
+        bricks = {{(numx - 2) / brick_size + 1, (numy - 2) / brick_size + 1, (numz - 2) / brick_size + 1}};
+        num_segments = (numz - 1) / brick_size + 1;
+        brick_triangles.resize(num_bricks());
+        changed.resize(num_bricks());
+        ids.resize(this->num_threads, std::vector<size_t>(static_cast<size_t>(brick_slots)));
+    }
+
+    /*
+        Returns the shape of the volumes
+    */
+    std::array<int, 3> shape() const {
+        return {{numx, numy, numz}};
+    }
+
+    /*
+        Returns the number of bricks of the grid
+    */
+    size_t num_bricks() const {
+        return static_cast<size_t>(bricks[0]) * bricks[1] * bricks[2];
+    }
+
+    /*
+        Forgets the previous frame, so the next one is marched completely
+    */
+    void reset() {
+        has_previous = false;
+    }
+
+    /*
+        Extracts the isosurface of the next frame
+        @param volume The samples of the frame
+        @param vertices, polygons The mesh, three coordinates per vertex and three indices per
+        triangle
+        @return The number of bricks marched (the others reused their triangles)
+    */
+    size_t extract(const double* volume, double isovalue, std::vector<double>& vertices, std::vector<size_t>& polygons) {
+        using namespace private_;
+
+        // States of the grid points and bricks whose states changed
+        previous_signs.swap(counts.signs);
+        counts.signs.resize(static_cast<size_t>(numx) * numy * numz);
+        parallelRanges(numx, num_threads, [&](int first, int last, int) {
+            size_t begin = static_cast<size_t>(first) * numy * numz, end = static_cast<size_t>(last) * numy * numz;
+            for (size_t p = begin; p < end; ++p)
+            {
+                counts.signs[p] = pointState(volume[p], isovalue);
+            }
+        });
+
+        int count = static_cast<int>(num_bricks());
+        parallelRanges(count, num_threads, [&](int first, int last, int) {
+            for (int b = first; b < last; ++b)
+            {
+                changed[b] = !has_previous || signsChanged(b);
+            }
+        });
+        has_previous = true;
+
+        // Vertices, numbered as in write_mesh. The first vertex of every segment of brick_size
+        // points of a row is kept to number the vertices of the bricks
+        segment_vertices.assign(static_cast<size_t>(numx) * numy * num_segments + 1, 0);
+        edge_masks.resize(counts.signs.size());
+        parallelRanges(numx, num_threads, [&](int first, int last, int) {
+            for (int i = first; i < last; ++i)
+            {
+                for (int j = 0; j < numy; ++j)
+                {
+                    size_t* segments = &segment_vertices[(static_cast<size_t>(i) * numy + j) * num_segments + 1];
+                    uint16_t* masks = &edge_masks[(static_cast<size_t>(i) * numy + j) * numz];
+                    for (int k = 0; k < numz; ++k)
+                    {
+                        unsigned mask = masks[k] = vertexMask(counts, i, j, k);
+                        for (; mask != 0; mask &= mask - 1)
+                        {
+                            ++segments[k / brick_size];
+                        }
+                    }
+                }
+            }
+        });
+        std::partial_sum(segment_vertices.begin(), segment_vertices.end(), segment_vertices.begin());
+
+        vertices.resize(3 * segment_vertices.back());
+        parallelRanges(numx, num_threads, [&](int first, int last, int) {
+            for (int i = first; i < last; ++i)
+            {
+                for (int j = 0; j < numy; ++j)
+                {
+                    size_t id = segment_vertices[(static_cast<size_t>(i) * numy + j) * num_segments];
+                    const uint16_t* masks = &edge_masks[(static_cast<size_t>(i) * numy + j) * numz];
+                    for (int k = 0; k < numz; ++k)
+                    {
+                        unsigned mask = masks[k];
+                        for (int s = 0; mask != 0; ++s, mask >>= 1)
+                        {
+                            if (!(mask & 1))
+                            {
+                                continue;
+                            }
+                            long x0 = i, y0 = j, z0 = k;
+                            if (s == pointSlot)
+                            {
+                                vertices[3 * id] = x0;
+                                vertices[3 * id + 1] = y0;
+                                vertices[3 * id + 2] = z0;
+                                ++id;
+                                continue;
+                            }
+                            const int* direction = edgeDirections[s];
+                            long x1 = i + direction[0], y1 = j + direction[1], z1 = k + direction[2];
+                            double t = inverseLinearInterpolation(isovalue, sample(volume, x0, y0, z0),
+                                                                  sample(volume, x1, y1, z1), 0.0);
+                            vertices[3 * id] = x0 + t * (x1 - x0);
+                            vertices[3 * id + 1] = y0 + t * (y1 - y0);
+                            vertices[3 * id + 2] = z0 + t * (z1 - z0);
+                            ++id;
+                        }
+                    }
+                }
+            }
+        });
+
+        // Triangles of the changed bricks, as references to the vertex slots of the brick
+        parallelRanges(count, num_threads, [&](int first, int last, int range) {
+            for (int b = first; b < last; ++b)
+            {
+                if (changed[b])
+                {
+                    marchBrick(b, volume, isovalue, vertices, ids[range].data());
+                }
+            }
+        });
+
+        // Triangles of all the bricks, with the indices of the vertices of this frame
+        brick_offsets.assign(count + 1, 0);
+        for (int b = 0; b < count; ++b)
+        {
+            brick_offsets[b + 1] = brick_offsets[b] + brick_triangles[b].size() / 3;
+        }
+        polygons.resize(3 * brick_offsets.back());
+        parallelRanges(count, num_threads, [&](int first, int last, int range) {
+            for (int b = first; b < last; ++b)
+            {
+                if (brick_triangles[b].empty())
+                {
+                    continue;
+                }
+                size_t* brick_ids = ids[range].data();
+                brickVertexIds(b, brick_ids);
+                size_t* out = &polygons[3 * brick_offsets[b]];
+                for (auto edge : brick_triangles[b])
+                {
+                    *out++ = brick_ids[edge];
+                }
+            }
+        });
+
+        return std::count(changed.begin(), changed.end(), 1);
+    }
+
+private:
+
+    int numx, numy, numz;
+    int brick_size;
+    int num_threads;
+    std::array<int, 3> bricks;
+
+    // Number of segments of brick_size grid points of a row along z
+    int num_segments;
+
+    // States of the grid points of the current frame
+    MeshCounts counts;
+    std::vector<unsigned char> previous_signs;
+    bool has_previous;
+
+    // Index of the first vertex of every segment of every row, followed by the total
+    std::vector<size_t> segment_vertices;
+
+    // Slots of the vertices attached to every grid point (see vertexMask)
+    std::vector<uint16_t> edge_masks;
+
+    // Triangles of every brick as indices of the vertex slots of the brick (see brickVertexIds)
+    std::vector<std::vector<uint32_t>> brick_triangles;
+    std::vector<unsigned char> changed;
+    std::vector<size_t> brick_offsets;
+
+    // Indices of the vertices of the slots of a brick, per thread
+    std::vector<std::vector<size_t>> ids;
+
+    double sample(const double* volume, long x, long y, long z) const {
+        return volume[(x * numy + y) * numz + z];
+    }
+
+    /*
+        Returns the first cell and the last grid point of the brick b
+    */
+    void brickRange(int b, int lower[3], int upper[3]) const {
+        int index[3] = {b / (bricks[1] * bricks[2]), b / bricks[2] % bricks[1], b % bricks[2]};
+        const int shape[3] = {numx, numy, numz};
+        for (int a = 0; a < 3; ++a)
+        {
+            lower[a] = index[a] * brick_size;
+            upper[a] = std::min(lower[a] + brick_size, shape[a] - 1);
+        }
+    }
+
+    /*
+        Returns whether the state of a grid point of the brick b changed since the previous frame
+    */
+    bool signsChanged(int b) const {
+        int lower[3], upper[3];
+        brickRange(b, lower, upper);
+        for (int i = lower[0]; i <= upper[0]; ++i)
+        {
+            for (int j = lower[1]; j <= upper[1]; ++j)
+            {
+                size_t first = (static_cast<size_t>(i) * numy + j) * numz + lower[2];
+                if (memcmp(&counts.signs[first], &previous_signs[first], upper[2] - lower[2] + 1) != 0)
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /*
+        Stores the index of every vertex attached to the grid points of the brick b. The vertex in
+        slot s of the point (i, j, k) of the brick, relative to its first cell, is stored at
+        ((i * sizey + j) * sizez + k) * vertexSlots + s, where sizey and sizez are the numbers of
+        grid points of the brick
+    */
+    void brickVertexIds(int b, size_t* brick_ids) const {
+        int lower[3], upper[3];
+        brickRange(b, lower, upper);
+        const size_t sizey = upper[1] - lower[1] + 1, sizez = upper[2] - lower[2] + 1;
+        for (int i = lower[0]; i <= upper[0]; ++i)
+        {
+            for (int j = lower[1]; j <= upper[1]; ++j)
+            {
+                size_t id = segment_vertices[(static_cast<size_t>(i) * numy + j) * num_segments + lower[2] / brick_size];
+                size_t* point_ids = brick_ids + ((i - lower[0]) * sizey + (j - lower[1])) * sizez * private_::vertexSlots;
+                const uint16_t* masks = &edge_masks[(static_cast<size_t>(i) * numy + j) * numz];
+                for (int k = lower[2]; k <= upper[2]; ++k, point_ids += private_::vertexSlots)
+                {
+                    unsigned mask = masks[k];
+                    for (int s = 0; mask != 0; ++s, mask >>= 1)
+                    {
+                        if (mask & 1)
+                        {
+                            point_ids[s] = id++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /*
+        Marches the cells of the brick b as write_mesh does and stores its triangles
+    */
+    void marchBrick(int b, const double* volume, double isovalue, const std::vector<double>& vertices,
+                    size_t* brick_ids) {
+        using namespace private_;
+
+        int lower[3], upper[3];
+        brickRange(b, lower, upper);
+        const size_t sizey = upper[1] - lower[1] + 1, sizez = upper[2] - lower[2] + 1;
+        std::vector<uint32_t>& triangles = brick_triangles[b];
+        triangles.clear();
+        bool numbered = false;
+
+        for (int i = lower[0]; i < upper[0]; ++i)
+        {
+            for (int j = lower[1]; j < upper[1]; ++j)
+            {
+                for (int k = lower[2]; k < upper[2]; ++k)
+                {
+                    unsigned on;
+                    unsigned mask = cellMask(counts, i, j, k, on);
+                    if (mask == 0 || mask == 255)
+                    {
+                        continue;
+                    }
+                    if (!numbered)
+                    {
+                        brickVertexIds(b, brick_ids);
+                        numbered = true;
+                    }
+
+                    double position[8][3], value[8];
+                    for (int c = 0; c < 8; ++c)
+                    {
+                        long x = i + cellCorners[c][0], y = j + cellCorners[c][1], z = k + cellCorners[c][2];
+                        position[c][0] = x; position[c][1] = y; position[c][2] = z;
+                        value[c] = sample(volume, x, y, z);
+                    }
+
+                    for (auto& tetrahedron : cellSplit(counts.decomposition, (i + j + k) & 1))
+                    {
+                        int edges[2][3][2], order[4];
+                        int num_triangles = tetrahedronTriangles(tetrahedron, mask, edges, order);
+                        if (num_triangles == 0)
+                        {
+                            continue;
+                        }
+
+                        // The corner farthest from the isovalue orients the triangles as in write_mesh
+                        int reference = order[0];
+                        for (int c = 1; c < 4; ++c)
+                        {
+                            if (std::abs(value[order[c]] - isovalue) > std::abs(value[reference] - isovalue))
+                            {
+                                reference = order[c];
+                            }
+                        }
+                        bool positive = value[reference] > isovalue;
+
+                        for (int t = 0; t < num_triangles; ++t)
+                        {
+                            uint32_t edge[3];
+                            for (int e = 0; e < 3; ++e)
+                            {
+                                int corner, slot;
+                                edgeVertex(edges[t][e][0], edges[t][e][1], on, corner, slot);
+                                const int* offset = cellCorners[corner];
+                                size_t point = ((i + offset[0] - lower[0]) * sizey + (j + offset[1] - lower[1])) * sizez
+                                               + (k + offset[2] - lower[2]);
+                                edge[e] = static_cast<uint32_t>(vertexSlots * point + slot);
+                            }
+
+                            // Triangles collapsed to a grid point on the isovalue
+                            if (edge[0] == edge[1] && edge[1] == edge[2])
+                            {
+                                continue;
+                            }
+
+                            const double* p0 = &vertices[3 * brick_ids[edge[0]]];
+                            const double* p1 = &vertices[3 * brick_ids[edge[1]]];
+                            const double* p2 = &vertices[3 * brick_ids[edge[2]]];
+                            Vector3 A(p0[0], p0[1], p0[2]), B(p1[0], p1[1], p1[2]), C(p2[0], p2[1], p2[2]);
+                            Vector3 R(position[reference][0], position[reference][1], position[reference][2]);
+                            if (swapOrientation(A, B, C, R, positive))
+                            {
+                                std::swap(edge[1], edge[2]);
+                            }
+
+                            triangles.insert(triangles.end(), edge, edge + 3);
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+
+}
+
+#endif // _TIMESERIES_H
@@ -0,0 +1,222 @@
+
+#include "vertexcache.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace mc
+{
+
+namespace private_
+{
+
+const size_t none = static_cast<size_t>(-1);
+
+/*
+	Returns a vertex that still has triangles to emit, taking first the most recent vertices of
+	the emitted triangles and then the vertices in index order after cursor. Returns none when all
+	the triangles have been emitted
+*/
+size_t skipDeadEnd(const std::vector<size_t>& live, std::vector<size_t>& dead_end, size_t& cursor)
+{
+	while (!dead_end.empty())
+	{
+		size_t v = dead_end.back();
+		dead_end.pop_back();
+		if (live[v] > 0)
+		{
+			return v;
+		}
+	}
+	for (; cursor < live.size(); ++cursor)
+	{
+		if (live[cursor] > 0)
+		{
+			return cursor;
+		}
+	}
+	return none;
+}
+
+}
+
+double average_cache_miss_ratio(const size_t* polygons, size_t num_triangles, size_t num_vertices,
+                                size_t cache_size)
+{
+	if (num_triangles == 0)
+	{
+		return 0.0;
+	}
+
+	// A vertex is in the FIFO cache if less than cache_size misses happened since its own
+	std::vector<size_t> cache_time(num_vertices, 0);
+	size_t time = cache_size + 1;
+	size_t misses = 0;
+	for (size_t i = 0; i < 3 * num_triangles; ++i)
+	{
+		size_t v = polygons[i];
+		if (time - cache_time[v] > cache_size)
+		{
+			cache_time[v] = time++;
+			++misses;
+		}
+	}
+	return static_cast<double>(misses) / num_triangles;
+}
+
+void tipsify(const size_t* polygons, size_t num_triangles, size_t num_vertices, size_t cache_size,
+             std::vector<size_t>& order)
+{
+	using private_::none;
+
+	order.clear();
+	order.reserve(num_triangles);
+
+	// Triangles around every vertex, as compressed rows
+	std::vector<size_t> offsets(num_vertices + 1, 0);
+	for (size_t i = 0; i < 3 * num_triangles; ++i)
+	{
+		++offsets[polygons[i] + 1];
+	}
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	std::vector<size_t> adjacency(3 * num_triangles);
+	std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < 3 * num_triangles; ++i)
+	{
+		adjacency[fill[polygons[i]]++] = i / 3;
+	}
+
+	// Number of triangles still to emit around every vertex
+	std::vector<size_t> live(num_vertices);
+	for (size_t v = 0; v < num_vertices; ++v)
+	{
+		live[v] = offsets[v + 1] - offsets[v];
+	}
+
+	std::vector<size_t> cache_time(num_vertices, 0);
+	std::vector<char> emitted(num_triangles, 0);
+	std::vector<size_t> dead_end;
+	std::vector<size_t> candidates;
+	size_t time = cache_size + 1;
+	size_t cursor = 0;
+
+	size_t fanning = private_::skipDeadEnd(live, dead_end, cursor);
+	while (fanning != none)
+	{
+		// Emit the remaining triangles around the fanning vertex
+		candidates.clear();
+		for (size_t a = offsets[fanning]; a < offsets[fanning + 1]; ++a)
+		{
+			size_t t = adjacency[a];
+			if (emitted[t])
+			{
+				continue;
+			}
+			emitted[t] = 1;
+			order.push_back(t);
+			for (int c = 0; c < 3; ++c)
+			{
+				size_t v = polygons[3 * t + c];
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (time - cache_time[v] > cache_size)
+				{
+					cache_time[v] = time++;
+				}
+			}
+		}
+
+		// The next fanning vertex is the oldest candidate that will still be in the cache after
+		// emitting its triangles, or the most recent dead-end vertex
+		size_t best = none;
+		size_t best_priority = 0;
+		for (size_t v : candidates)
+		{
+			if (live[v] == 0)
+			{
+				continue;
+			}
+			size_t priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= cache_size)
+			{
+				priority = time - cache_time[v];
+			}
+			if (best == none || priority > best_priority)
+			{
+				best = v;
+				best_priority = priority;
+			}
+		}
+		fanning = best != none ? best : private_::skipDeadEnd(live, dead_end, cursor);
+	}
+}
+
+void optimize_vertex_cache(std::vector<double>& vertices, std::vector<size_t>& polygons,
+                           std::vector<double>& attributes, size_t num_attributes, std::vector<size_t>& labels,
+                           size_t cache_size, double& acmr_before, double& acmr_after)
+{
+	using private_::none;
+
+	size_t num_vertices = vertices.size() / 3;
+	size_t num_triangles = polygons.size() / 3;
+	acmr_before = average_cache_miss_ratio(polygons.data(), num_triangles, num_vertices, cache_size);
+
+	// Reorder the triangles
+	std::vector<size_t> order;
+	tipsify(polygons.data(), num_triangles, num_vertices, cache_size, order);
+	std::vector<size_t> new_polygons(polygons.size());
+	for (size_t t = 0; t < num_triangles; ++t)
+	{
+		std::copy(&polygons[3 * order[t]], &polygons[3 * order[t]] + 3, &new_polygons[3 * t]);
+	}
+	if (average_cache_miss_ratio(new_polygons.data(), num_triangles, num_vertices, cache_size) < acmr_before)
+	{
+		polygons.swap(new_polygons);
+		if (!labels.empty())
+		{
+			std::vector<size_t> new_labels(num_triangles);
+			for (size_t t = 0; t < num_triangles; ++t)
+			{
+				new_labels[t] = labels[order[t]];
+			}
+			labels.swap(new_labels);
+		}
+	}
+
+	// Renumber the vertices in fetch order. Unused vertices go last
+	std::vector<size_t> remap(num_vertices, none);
+	size_t next = 0;
+	for (auto& p : polygons)
+	{
+		if (remap[p] == none)
+		{
+			remap[p] = next++;
+		}
+		p = remap[p];
+	}
+	for (auto& r : remap)
+	{
+		if (r == none)
+		{
+			r = next++;
+		}
+	}
+
+	std::vector<double> new_vertices(vertices.size());
+	std::vector<double> new_attributes(attributes.size());
+	for (size_t v = 0; v < num_vertices; ++v)
+	{
+		std::copy(&vertices[3 * v], &vertices[3 * v] + 3, &new_vertices[3 * remap[v]]);
+		for (size_t a = 0; a < num_attributes; ++a)
+		{
+			new_attributes[remap[v] * num_attributes + a] = attributes[v * num_attributes + a];
+		}
+	}
+	vertices.swap(new_vertices);
+	attributes.swap(new_attributes);
+
+	acmr_after = average_cache_miss_ratio(polygons.data(), num_triangles, num_vertices, cache_size);
+}
+
+}
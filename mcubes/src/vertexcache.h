@@ -0,0 +1,45 @@
+
+#ifndef _VERTEXCACHE_H
+#define _VERTEXCACHE_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace mc
+{
+
+/*
+	Returns the average cache miss ratio (ACMR) of a triangle list: the number of vertices
+	transformed per triangle when the triangles are drawn in order with a FIFO post-transform
+	vertex cache of cache_size entries. It ranges from about 0.5 (ideal ordering of a large
+	regular mesh) to 3
+*/
+double average_cache_miss_ratio(const size_t* polygons, size_t num_triangles, size_t num_vertices,
+                                size_t cache_size);
+
+/*
+	Computes an order of the triangles with good vertex cache locality with Tipsify (Sander,
+	Nehab & Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007):
+	the triangles around a fanning vertex are emitted together and the next fanning vertex is
+	chosen among the ones of the emitted triangles that will still be in the cache. Runs in time
+	linear in the size of the mesh
+	@param order The indices of the triangles in the new order
+*/
+void tipsify(const size_t* polygons, size_t num_triangles, size_t num_vertices, size_t cache_size,
+             std::vector<size_t>& order);
+
+/*
+	Reorders the triangles of a mesh for a vertex cache of cache_size entries (see tipsify) and
+	renumbers the vertices in the order they are first used by the triangles, so the vertex
+	fetches are sequential too. The orientation of the triangles is kept. The per-vertex
+	attributes and the per-triangle labels (if not empty) are permuted along with the mesh. The
+	triangles keep their order if reordering them does not lower the ACMR
+	@param acmr_before, acmr_after The ACMR of the mesh before and after the reordering
+*/
+void optimize_vertex_cache(std::vector<double>& vertices, std::vector<size_t>& polygons,
+                           std::vector<double>& attributes, size_t num_attributes, std::vector<size_t>& labels,
+                           size_t cache_size, double& acmr_before, double& acmr_after);
+
+}
+
+#endif // _VERTEXCACHE_H
@@ -22,16 +22,31 @@ def extensions():
         [
             "mcubes/src/_mcubes.pyx",
             "mcubes/src/pywrapper.cpp",
-            "mcubes/src/marchingcubes.cpp"
+            "mcubes/src/marchingcubes.cpp",
+            "mcubes/src/decimation.cpp",
+            "mcubes/src/vertexcache.cpp"
         ],
         language="c++",
-        extra_compile_args=['-std=c++11', '-Wall'],
+        extra_compile_args=['-std=c++11', '-Wall', '-pthread'],
+        extra_link_args=['-pthread'],
         include_dirs=[numpy_include_dir],
         depends=[
             "mcubes/src/marchingcubes.h",
+            "mcubes/src/chunked.h",
+            "mcubes/src/compact.h",
+            "mcubes/src/decimation.h",
+            "mcubes/src/mesher.h",
+            "mcubes/src/vertexcache.h",
+            "mcubes/src/ThreadPool.h",
+            "mcubes/src/UnionFind.h",
+            "mcubes/src/VertexMap.h",
+            "mcubes/src/pyramid.h",
             "mcubes/src/pyarray_symbol.h",
             "mcubes/src/pyarraymodule.h",
-            "mcubes/src/pywrapper.h"
+            "mcubes/src/pywrapper.h",
+            "mcubes/src/timeseries.h",
+            "mcubes/src/Triangle.h",
+            "mcubes/src/Vector3.h"
         ],
         define_macros=[("NPY_NO_DEPRECATED_API", "NPY_1_7_API_VERSION")],
     )
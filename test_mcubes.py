@@ -1,4 +1,8 @@
 
+import ctypes
+import os
+from concurrent.futures import ThreadPoolExecutor
+
 import pytest
 
 import numpy as np
@@ -43,6 +47,187 @@ def test_no_duplicates():
     assert len(vertices) == len(np.unique(vertices, axis=0))
 
 
+def test_attributes():
+    x, y, z = np.mgrid[:30, :30, :30]
+    u = (x - 15)**2 + (y - 15)**2 + (z - 15)**2 - 8**2
+    labels = np.full(u.shape, 7, dtype=np.uint8)
+
+    vertices1, triangles1 = mcubes.marching_cubes(u, 0.0)
+    vertices2, triangles2, (attr_x, attr_z, attr_labels) = mcubes.marching_cubes(
+        u, 0.0, attributes=[x, z.astype(np.float32), labels]
+    )
+
+    assert_allclose(vertices1, vertices2)
+    assert_array_equal(triangles1, triangles2)
+
+    # Linear channels are reproduced exactly at the edge crossings
+    assert_allclose(attr_x, vertices2[:, 0])
+    assert_allclose(attr_z, vertices2[:, 2])
+    assert_allclose(attr_labels, 7)
+
+    _, _, attrs = mcubes.marching_cubes(u, 0.0, attributes=[])
+    assert attrs == []
+
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes(u, 0.0, attributes=[x[:-1]])
+
+
+def test_components():
+    x, y, z = np.mgrid[:60, :40, :40]
+    big = np.sqrt((x - 18)**2 + (y - 20)**2 + (z - 20)**2) - 12
+    small = np.sqrt((x - 48)**2 + (y - 20)**2 + (z - 20)**2) - 4
+    u = -np.minimum(big, small)
+
+    vertices, triangles = mcubes.marching_cubes(u, 0.0)
+    _, triangles2, labels = mcubes.marching_cubes(u, 0.0, return_labels=True)
+
+    assert_array_equal(triangles, triangles2)
+    assert labels.shape == (len(triangles),)
+    assert set(labels) == {0, 1}
+    assert np.count_nonzero(labels == 0) > np.count_nonzero(labels == 1)
+
+    # Faces of different shells do not share vertices
+    assert not set(triangles[labels == 0].ravel()) & set(triangles[labels == 1].ravel())
+
+    # Small shell lies around its own center
+    assert np.all(vertices[triangles[labels == 1].ravel(), 0] > 40)
+
+    vertices_l, triangles_l = mcubes.marching_cubes(u, 0.0, keep_largest=True)
+    assert len(triangles_l) == np.count_nonzero(labels == 0)
+    assert len(vertices_l) == len(np.unique(triangles[labels == 0]))
+    assert triangles_l.max() == len(vertices_l) - 1
+    assert np.all(vertices_l[:, 0] < 40)
+
+    min_triangles = np.count_nonzero(labels == 1) + 1
+    vertices_m, triangles_m, labels_m = mcubes.marching_cubes(
+        u, 0.0, return_labels=True, min_triangles=min_triangles
+    )
+    assert_allclose(vertices_m, vertices_l)
+    assert_array_equal(triangles_m, triangles_l)
+    assert np.all(labels_m == 0)
+
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes(u, 0.0, min_triangles=-1)
+
+
+def test_cleanup():
+    # Integer volume: many grid corners lie exactly on the isosurface
+    x, y, z = np.mgrid[:40, :40, :40]
+    u = (x - 20)**2 + (y - 20)**2 + (z - 20)**2 - 12**2
+
+    vertices1, triangles1 = mcubes.marching_cubes(u, 0.0)
+    vertices2, triangles2, info = mcubes.marching_cubes(u, 0.0, cleanup=True, return_info=True)
+
+    assert info["removed_triangles"] > 0
+    assert len(triangles2) <= len(triangles1) - info["removed_triangles"]
+
+    a, b, c = (vertices2[triangles2[:, i]] for i in range(3))
+    assert np.all(np.linalg.norm(np.cross(b - a, c - a), axis=1) > 0)
+    assert_array_equal(np.unique(triangles2), np.arange(len(vertices2)))
+    assert len(vertices2) == len(np.unique(vertices2, axis=0))
+
+    # Snapped vertices lie on the grid corners
+    vertices3, _ = mcubes.marching_cubes(u, 0.5, cleanup=True, tolerance=0.1)
+    frac = np.abs(vertices3 - np.round(vertices3))
+    assert np.all((frac == 0) | (frac >= 0.1 - 1e-9))
+
+    # Every triangle dropped by the cleanup is reported, including the ones collapsed by snapping
+    w = np.sin(x / 3.1) * np.cos(y / 2.7) + np.sin(z / 3.7)
+    _, triangles4 = mcubes.marching_cubes(w, 0.25)
+    _, triangles5, info = mcubes.marching_cubes(w, 0.25, cleanup=True, tolerance=0.05, return_info=True)
+    assert info["removed_triangles"] == len(triangles4) - len(triangles5) > 0
+
+    # Without cleanup no statistics are reported
+    _, _, info = mcubes.marching_cubes(u, 0.0, return_info=True)
+    assert info == {}
+
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes(u, 0.0, cleanup=True, tolerance=0.5)
+
+
+def test_decomposition():
+    x, y, z = np.mgrid[:50, :50, :50]
+    u = np.sqrt((x - 25)**2 + (y - 25)**2 + (z - 25)**2) - 16 + 2 * np.sin(x / 3) * np.cos(y / 4)
+
+    vertices6, triangles6 = mcubes.marching_cubes(u, 0.0)
+    vertices5, triangles5 = mcubes.marching_cubes(u, 0.0, decomposition=5)
+    assert len(triangles5) < 0.9 * len(triangles6)
+
+    # Both splits give watertight meshes: every directed edge appears once and its twin once
+    for triangles in (triangles6, triangles5):
+        edges = np.concatenate([triangles[:, [0, 1]], triangles[:, [1, 2]], triangles[:, [2, 0]]])
+        _, counts = np.unique(edges, axis=0, return_counts=True)
+        assert np.all(counts == 1)
+        _, counts = np.unique(np.sort(edges, axis=1), axis=0, return_counts=True)
+        assert np.all(counts == 2)
+
+    # Same vertices on the cell edges, which both splits share
+    on_edges = lambda v: v[np.sum(v != np.round(v), axis=1) <= 1]
+    assert len(on_edges(vertices5)) == len(on_edges(vertices6))
+
+    f = lambda x, y, z: x**2 + y**2 + z**2
+    _, triangles = mcubes.marching_cubes_func((-1, -1, -1), (1, 1, 1), 20, 20, 20, f, 0.5, decomposition=5)
+    _, counts = np.unique(np.sort(np.concatenate([triangles[:, [0, 1]], triangles[:, [1, 2]],
+                                                  triangles[:, [2, 0]]]), axis=1), axis=0, return_counts=True)
+    assert np.all(counts == 2)
+
+    # The keyword comes after the existing ones
+    _, _, info = mcubes.marching_cubes(u, 0.0, None, False, 0, False, False, 1e-3, 0, True)
+    assert info == {}
+
+    # The other entry points split the cells alike
+    v = u[10:40, 10:40, 10:40]
+    vertices5, triangles5 = mcubes.marching_cubes(v, 0.0, decomposition=5)
+    vertices7, triangles7 = mcubes.marching_cubes_exact(v, 0.0, num_threads=2, decomposition=5)
+    assert (len(vertices7), len(triangles7)) == mcubes.marching_cubes_count(v, 0.0, decomposition=5)
+    index = {tuple(p): i for i, p in enumerate(np.round(vertices5, 6))}
+    mapping = np.array([index[tuple(p)] for p in np.round(vertices7, 6)])
+    assert_array_equal(mapping[triangles7], triangles5)
+
+    meshes = [mcubes.Mesher(v.shape, decomposition=5)(v, 0.0),
+              mcubes.marching_cubes_lod(v, 0.0, levels=1, decomposition=5)[0],
+              mcubes.marching_cubes_series(v[None], 0.0, brick_size=8, decomposition=5)[0]]
+    for vertices8, triangles8 in meshes:
+        assert_array_equal(vertices8, vertices7)
+        assert_array_equal(np.unique(np.sort(triangles8, axis=1), axis=0),
+                           np.unique(np.sort(triangles7, axis=1), axis=0))
+
+    vertices9, triangles9, _, _ = mcubes.marching_cubes_batch([v], 0.0, decomposition=5)
+    assert_array_equal(triangles9, triangles5)
+
+    for name in ["marching_cubes_count", "marching_cubes_exact", "marching_cubes_lod", "marching_cubes_series"]:
+        with pytest.raises(ValueError):
+            getattr(mcubes, name)(v[None] if name.endswith("series") else v, 0.0, decomposition=4)
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes(u, 0.0, decomposition=4)
+
+
+def test_decimate():
+    x, y, z = np.mgrid[:60, :60, :60]
+    u = np.sqrt((x - 30)**2 + (y - 30)**2 + (z - 30)**2) - 20
+    vertices, triangles = mcubes.marching_cubes(u, 0.0, cleanup=True)
+
+    target = len(triangles) // 10
+    for num_threads in [1, 4]:
+        vertices2, triangles2 = mcubes.decimate(vertices, triangles, target, num_threads=num_threads)
+
+        assert len(triangles2) <= target
+        assert_array_equal(np.unique(triangles2), np.arange(len(vertices2)))
+
+        # Still a closed manifold close to the sphere
+        edges = np.sort(triangles2[:, [0, 1, 1, 2, 2, 0]].reshape(-1, 2), axis=1)
+        _, counts = np.unique(edges, axis=0, return_counts=True)
+        assert np.all(counts == 2)
+        dist = np.linalg.norm(vertices2 - 30, axis=1)
+        assert np.all(np.abs(dist - 20) < 0.2)
+
+    vertices3, triangles3 = mcubes.decimate(vertices, triangles, max_error=1e-3)
+    assert target < len(triangles3) < len(triangles)
+
+    with pytest.raises(ValueError):
+        mcubes.decimate(vertices, triangles)
+
+
 def test_export():
 
     u = np.zeros((10, 10, 10))
@@ -54,6 +239,367 @@ def test_export():
     mcubes.export_mesh(vertices, triangles, "output/test.dae")
 
 
+def test_native_function():
+    from scipy import LowLevelCallable
+
+    signature = ctypes.CFUNCTYPE(ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_void_p)
+
+    def sphere(x, y, z, user_data):
+        radius = ctypes.cast(user_data, ctypes.POINTER(ctypes.c_double))[0]
+        return x**2 + y**2 + z**2 - radius**2
+
+    def func(x, y, z):
+        return x**2 + y**2 + z**2 - 1
+
+    cfunc = signature(sphere)
+    radius = ctypes.c_double(1.0)
+    radius_ptr = ctypes.cast(ctypes.pointer(radius), ctypes.c_void_p)
+    args = ((-1.5, -1.5, -1.5), (1.5, 1.5, 1.5), 30, 30, 30)
+
+    vertices1, triangles1 = mcubes.marching_cubes_func(*args, func, 0)
+    vertices2, triangles2 = mcubes.marching_cubes_func(*args, cfunc, 0, user_data=radius_ptr)
+    vertices3, triangles3 = mcubes.marching_cubes_func(*args, LowLevelCallable(cfunc, radius_ptr), 0, num_threads=3)
+
+    assert_array_equal(vertices1, vertices2)
+    assert_array_equal(triangles1, triangles2)
+    assert_array_equal(vertices1, vertices3)
+    assert_array_equal(triangles1, triangles3)
+
+    # The slabs marched in parallel are joined into the mesh of a single thread
+    vertices4, triangles4 = mcubes.marching_cubes_func(*args, func, 0, cleanup=True, decomposition=5)
+    vertices5, triangles5 = mcubes.marching_cubes_func(*args, cfunc, 0, user_data=radius_ptr, num_threads=4,
+                                                       cleanup=True, decomposition=5)
+    assert_array_equal(vertices4, vertices5)
+    assert_array_equal(triangles4, triangles5)
+
+    wrong_signature = ctypes.CFUNCTYPE(ctypes.c_float, ctypes.c_double, ctypes.c_double, ctypes.c_double)
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes_func(*args, wrong_signature(lambda x, y, z: 0.0), 0)
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes_func(*args, LowLevelCallable(cfunc, radius_ptr), 0, user_data=radius_ptr)
+
+
+def test_adaptive():
+
+    def sphere(x, y, z):
+        return np.sqrt(x**2 + y**2 + z**2) - 1
+
+    lower, upper = (-1.5, -1.5, -1.5), (1.5, 1.5, 1.5)
+    vertices1, triangles1 = mcubes.marching_cubes_func(lower, upper, 61, 61, 61, sphere, 0, cleanup=True)
+
+    for lipschitz in [1.0, None]:
+        vertices2, triangles2, info = mcubes.marching_cubes_adaptive(lower, upper, 0.05, sphere, 0,
+                                                                     lipschitz=lipschitz, cleanup=True,
+                                                                     return_info=True)
+        assert_array_equal(vertices1, vertices2)
+        assert_array_equal(triangles1, triangles2)
+        assert info["saved_evaluations"] > 0
+        assert info["evaluations"] + info["saved_evaluations"] == 61**3
+
+        # Watertight: every edge is shared by exactly two triangles
+        edges = np.sort(triangles2[:, [0, 1, 1, 2, 2, 0]].reshape(-1, 2), axis=1)
+        _, counts = np.unique(edges, axis=0, return_counts=True)
+        assert np.all(counts == 2)
+
+    vertices3, triangles3 = mcubes.marching_cubes_func(lower, upper, 61, 61, 61, sphere, 0, decomposition=5)
+    vertices4, triangles4 = mcubes.marching_cubes_adaptive(lower, upper, 0.05, sphere, 0, lipschitz=1.0,
+                                                           decomposition=5)
+    assert_array_equal(vertices3, vertices4)
+    assert_array_equal(triangles3, triangles4)
+
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes_adaptive(lower, upper, 0.0, sphere, 0)
+
+
+def test_exact():
+    x, y, z = np.mgrid[:40, :40, :40]
+    u = np.sin(x / 5.0) * np.cos(y / 4.0) + np.sin(z / 3.0)
+
+    vertices1, triangles1 = mcubes.marching_cubes(u, 0.25)
+    num_vertices, num_triangles = mcubes.marching_cubes_count(u, 0.25)
+    assert (num_vertices, num_triangles) == (len(vertices1), len(triangles1))
+
+    for num_threads in [1, 3]:
+        vertices2, triangles2 = mcubes.marching_cubes_exact(u, 0.25, num_threads=num_threads)
+
+        # Same mesh with the vertices numbered by edge
+        index = {tuple(v): i for i, v in enumerate(np.round(vertices1, 6))}
+        mapping = np.array([index[tuple(v)] for v in np.round(vertices2, 6)])
+        assert_array_equal(mapping[triangles2], triangles1)
+
+    # Caller-provided buffers
+    out_vertices = np.empty((num_vertices + 10, 3))
+    out_faces = np.empty((num_triangles, 3), dtype=triangles1.dtype)
+    vertices3, triangles3 = mcubes.marching_cubes_exact(u, 0.25, out_vertices=out_vertices, out_faces=out_faces)
+    assert np.shares_memory(vertices3, out_vertices) and np.shares_memory(triangles3, out_faces)
+    assert_array_equal(vertices3, vertices2)
+    assert_array_equal(triangles3, triangles2)
+
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes_exact(u, 0.25, out_faces=out_faces[:-1])
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes_exact(u, 0.25, out_vertices=out_vertices.astype(np.float32))
+
+    # Samples on the isosurface: the cut edges ending at them share the vertex at the sample and
+    # the faces collapsed to it are dropped, as in marching_cubes
+    x, y, z = np.mgrid[:8, :8, :8]
+    w = (x - 4)**2 + (y - 4)**2 + (z - 4)**2 - 4
+    vertices4, triangles4 = mcubes.marching_cubes(w, 1.0)
+    vertices5, triangles5 = mcubes.marching_cubes_exact(w, 1.0)
+    assert (len(vertices5), len(triangles5)) == mcubes.marching_cubes_count(w, 1.0)
+    assert (len(vertices5), len(triangles5)) == (len(vertices4), len(triangles4))
+    index = {tuple(v): i for i, v in enumerate(np.round(vertices4, 6))}
+    mapping = np.array([index[tuple(v)] for v in np.round(vertices5, 6)])
+    assert_array_equal(mapping[triangles5], triangles4)
+
+
+def test_lod():
+    x, y, z = np.mgrid[:33, :30, :25]
+    u = np.sin(x / 5.0) * np.cos(y / 4.0) + np.sin(z / 3.0)
+
+    def downsample(volume, reduce):
+        # Reduce the 3x3x3 samples around every other sample, clamped to the volume
+        padded = np.pad(volume, 1, mode="constant", constant_values=np.nan)
+        windows = [padded[1 + di::2, 1 + dj::2, 1 + dk::2][:(volume.shape[0] + 1) // 2,
+                                                           :(volume.shape[1] + 1) // 2,
+                                                           :(volume.shape[2] + 1) // 2]
+                   for di in (-1, 0, 1) for dj in (-1, 0, 1) for dk in (-1, 0, 1)]
+        return reduce(np.stack(windows))
+
+    def mean(windows):
+        w = np.array([1, 2, 1])
+        weights = (w[:, None, None] * w[None, :, None] * w[None, None, :]).reshape(-1, 1, 1, 1)
+        weights = np.where(np.isnan(windows), 0, weights)
+        return np.nansum(windows * weights, axis=0) / weights.sum(axis=0)
+
+    for mode, reduce in [("mean", mean), ("min", lambda w: np.nanmin(w, axis=0)),
+                         ("max", lambda w: np.nanmax(w, axis=0))]:
+        meshes = mcubes.marching_cubes_lod(u, 0.25, levels=10, mode=mode, num_threads=2)
+        assert len(meshes) == 5
+
+        volume = u
+        for level, (vertices, triangles) in enumerate(meshes):
+            vertices1, triangles1 = mcubes.marching_cubes_exact(volume, 0.25)
+            assert_allclose(vertices, vertices1 * 2**level)
+            assert_array_equal(triangles, triangles1)
+            volume = downsample(volume, reduce)
+
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes_lod(u, 0.25, mode="median")
+
+
+def test_chunked(tmp_path):
+    x, y, z = np.mgrid[:50, :41, :33]
+    u = np.sin(x / 5.0) * np.cos(y / 4.0) + np.sin(z / 3.0)
+
+    store = mcubes.ChunkStore.create(str(tmp_path / "volume"), u, (16, 20, 13))
+    assert store.shape == u.shape and store.chunks == (16, 20, 13)
+
+    for prefetch, decomposition in [(True, 6), (False, 6), (True, 5)]:
+        vertices1, triangles1 = mcubes.marching_cubes(u, 0.25, decomposition=decomposition)
+        vertices2, triangles2 = mcubes.marching_cubes_chunked(store, 0.25, prefetch=prefetch,
+                                                              decomposition=decomposition)
+        assert vertices2.shape == vertices1.shape
+
+        # Same mesh up to the numbering of the vertices
+        index = {tuple(v): i for i, v in enumerate(np.round(vertices1, 6))}
+        mapping = np.array([index[tuple(v)] for v in np.round(vertices2, 6)])
+        assert_array_equal(np.sort(np.sort(mapping[triangles2], axis=1), axis=0),
+                           np.sort(np.sort(triangles1, axis=1), axis=0))
+
+
+def test_series():
+    x, y, z = np.mgrid[:40, :36, :30]
+    u = np.sin(x / 5.0) * np.cos(y / 4.0) + np.sin(z / 3.0)
+    frames = np.stack([u + 0.3 * np.exp(-((x - 10 - 2 * t)**2 + (y - 15)**2 + (z - 15)**2) / 10.0) for t in range(6)])
+
+    def oriented_triangles(triangles):
+        # Rotate every triangle to start at its smallest index
+        shift = np.argmin(triangles, axis=1)[:, None]
+        rotated = np.take_along_axis(triangles, (shift + np.arange(3)) % 3, axis=1)
+        return rotated[np.lexsort(rotated.T[::-1])]
+
+    meshes, info = mcubes.marching_cubes_series(frames, 0.25, brick_size=8, num_threads=2, return_info=True)
+    assert info["num_bricks"] == 5 * 5 * 4 and len(info["marched_bricks"]) == len(frames)
+    assert info["marched_bricks"][0] == info["num_bricks"]
+    assert 0 < info["marched_bricks"][1] < info["num_bricks"]
+
+    for frame, (vertices, triangles) in zip(frames, meshes):
+        vertices1, triangles1 = mcubes.marching_cubes_exact(frame, 0.25)
+        assert_array_equal(vertices, vertices1)
+        assert_array_equal(oriented_triangles(triangles), oriented_triangles(triangles1))
+
+    # Frames from an iterator are extracted one after another
+    meshes2, info2 = mcubes.marching_cubes_series(iter(frames), 0.25, brick_size=8, return_info=True)
+    assert info2["marched_bricks"][1:].max() < info2["num_bricks"]
+    for (vertices, triangles), (vertices2, triangles2) in zip(meshes, meshes2):
+        assert_array_equal(vertices2, vertices)
+        assert_array_equal(oriented_triangles(triangles2), oriented_triangles(triangles))
+
+    # Bricks larger than the grid only take the room of the grid
+    frames = np.random.default_rng(0).random((3, 10, 10, 10))
+    meshes = mcubes.marching_cubes_series(frames, 0.5, brick_size=200, num_threads=1)
+    for frame, (vertices3, triangles3) in zip(frames, meshes):
+        vertices4, triangles4 = mcubes.marching_cubes_exact(frame, 0.5)
+        assert_array_equal(vertices3, vertices4)
+        assert_array_equal(oriented_triangles(triangles3), oriented_triangles(triangles4))
+
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes_series([u, u[:-1]], 0.25)
+
+
+def test_mesher():
+    x, y, z = np.mgrid[:30, :30, :30]
+    mesher = mcubes.Mesher((30, 30, 30))
+    assert mesher.shape == (30, 30, 30)
+
+    out_vertices = np.empty((20000, 3))
+    out_faces = np.empty((40000, 3), dtype=mcubes.marching_cubes(np.zeros((2, 2, 2)), 0)[1].dtype)
+    for r in [5, 8, 11]:
+        u = (x - 15)**2 + (y - 15)**2 + (z - 15)**2 - r**2
+        vertices1, triangles1 = mcubes.marching_cubes_exact(u, 0.0)
+
+        # Repeated calls write into the same buffers
+        vertices2, triangles2 = mesher(u, 0.0, out_vertices=out_vertices, out_faces=out_faces)
+        assert np.shares_memory(vertices2, out_vertices) and np.shares_memory(triangles2, out_faces)
+        assert_array_equal(vertices2, vertices1)
+        assert_array_equal(triangles2, triangles1)
+
+    # Without buffers new arrays are returned
+    vertices3, triangles3 = mesher(u, 0.0)
+    assert not np.shares_memory(vertices3, out_vertices)
+    assert_array_equal(vertices3, vertices1)
+    assert_array_equal(triangles3, triangles1)
+
+    # Concurrent calls on the same mesher do not mix their meshes
+    volumes = [(x - 15)**2 + (y - 15)**2 + (z - 15)**2 - r**2 for r in [5, 11] * 4]
+    with ThreadPoolExecutor(4) as executor:
+        meshes = list(executor.map(lambda v: mesher(v, 0.0), volumes))
+    for volume, (vertices4, triangles4) in zip(volumes, meshes):
+        vertices5, triangles5 = mcubes.marching_cubes_exact(volume, 0.0)
+        assert_array_equal(vertices4, vertices5)
+        assert_array_equal(triangles4, triangles5)
+
+    # Buffers too small for the mesh are replaced by new arrays
+    vertices6, triangles6 = mesher(u, 0.0, out_vertices=out_vertices[:10], out_faces=out_faces[:10])
+    assert not np.shares_memory(vertices6, out_vertices) and not np.shares_memory(triangles6, out_faces)
+    assert_array_equal(vertices6, vertices1)
+    assert_array_equal(triangles6, triangles1)
+
+    with pytest.raises(ValueError):
+        mesher(u, 0.0, out_vertices=np.empty(3 * 20000 + 1), out_faces=out_faces)
+    with pytest.raises(ValueError):
+        mesher(u, 0.0, out_vertices=out_vertices.astype(np.float32), out_faces=out_faces)
+    with pytest.raises(ValueError):
+        mesher(u[:-1], 0.0)
+    with pytest.raises(RuntimeError):
+        mcubes.Mesher((1, 30, 30))
+
+
+def test_vertex_cache():
+    x, y, z = np.mgrid[:40, :40, :40]
+    u = np.sin(x / 5.0) * np.cos(y / 4.0) + np.sin(z / 3.0)
+    vertices1, triangles1 = mcubes.marching_cubes(u, 0.25)
+
+    vertices2, triangles2, info = mcubes.optimize_vertex_cache(vertices1, triangles1, return_info=True)
+    assert info["acmr_after"] < info["acmr_before"]
+    assert vertices2.shape == vertices1.shape and triangles2.shape == triangles1.shape
+
+    # Same oriented triangles, and vertices numbered in fetch order
+    def oriented_triangles(vertices, triangles):
+        result = set()
+        for tri in np.round(vertices, 6)[triangles].tolist():
+            i = tri.index(min(tri))
+            result.add(tuple(map(tuple, tri[i:] + tri[:i])))
+        return result
+
+    assert oriented_triangles(vertices1, triangles1) == oriented_triangles(vertices2, triangles2)
+    _, first = np.unique(triangles2.ravel(), return_index=True)
+    assert np.all(np.diff(first) > 0)
+
+    # Per-vertex attributes and per-face labels follow the mesh in the extraction
+    vertices3, triangles3, attributes, labels, info = mcubes.marching_cubes(
+        u, 0.25, attributes=[x], return_labels=True, cache_size=16, return_info=True)
+    assert_allclose(attributes[0], vertices3[:, 0])
+    assert info["acmr_after"] < info["acmr_before"]
+    _, _, labels1 = mcubes.marching_cubes(u, 0.25, return_labels=True)
+    assert_array_equal(np.bincount(labels), np.bincount(labels1))
+    vertex_labels = np.empty(len(vertices3), dtype=labels.dtype)
+    vertex_labels[triangles3] = labels[:, None]
+    assert np.all(vertex_labels[triangles3] == labels[:, None])
+
+
+def test_batch():
+    x, y, z = np.mgrid[:20, :20, :20]
+    volumes = np.stack([(x - 10)**2 + (y - 10)**2 + (z - 10)**2 - r**2 for r in [3, 5, 7, 20]])
+    isovalues = [0.0, 0.5, -0.25, 0.0]
+
+    for stacked in [volumes, list(volumes)]:
+        for num_threads in [1, 3]:
+            vertices, triangles, vertex_offsets, face_offsets = mcubes.marching_cubes_batch(
+                stacked, isovalues, num_threads=num_threads)
+
+            assert len(vertex_offsets) == len(face_offsets) == len(volumes) + 1
+            assert vertex_offsets[-1] == len(vertices) and face_offsets[-1] == len(triangles)
+            for i, (volume, isovalue) in enumerate(zip(volumes, isovalues)):
+                vertices1, triangles1 = mcubes.marching_cubes(volume, isovalue)
+                assert_array_equal(vertices[vertex_offsets[i]:vertex_offsets[i + 1]], vertices1)
+                assert_array_equal(triangles[face_offsets[i]:face_offsets[i + 1]], triangles1)
+
+    # Volumes of different shapes and a single isovalue
+    _, _, vertex_offsets, _ = mcubes.marching_cubes_batch([volumes[0], volumes[1][:15, :12]], 0.0)
+    assert vertex_offsets[1] > 0 and vertex_offsets[2] > vertex_offsets[1]
+
+    with pytest.raises(ValueError):
+        mcubes.marching_cubes_batch(volumes, [0.0, 1.0])
+
+
+def test_compact(tmp_path):
+    x, y, z = np.mgrid[:40, :40, :40]
+    u = np.sin(x / 5.0) * np.cos(y / 4.0) + np.sin(z / 3.0)
+    vertices, triangles = mcubes.marching_cubes(u, 0.25)
+
+    filename = str(tmp_path / "mesh.mcq")
+    mcubes.export_compact(vertices, triangles, filename, block_size=1000)
+    for num_threads in [1, 3]:
+        vertices2, triangles2 = mcubes.load_compact(filename, num_threads=num_threads)
+        assert_allclose(vertices2, vertices, atol=2.0**-17)
+        assert_array_equal(triangles2, triangles)
+
+    # Only the coordinate along the edge is quantized
+    on_grid = vertices == np.round(vertices)
+    assert_array_equal(vertices2[on_grid], vertices[on_grid])
+
+    # Grid of a function and coarser quantization
+    f = lambda x, y, z: x**2 + y**2 + z**2 - 1
+    vertices, triangles = mcubes.marching_cubes_func((-2, -2, -2), (2, 2, 2), 41, 41, 41, f, 0)
+    mcubes.export_compact(vertices, triangles, filename, origin=(-2, -2, -2), spacing=(0.1, 0.1, 0.1), bits=8)
+    vertices2, triangles2 = mcubes.load_compact(filename)
+    assert_allclose(vertices2, vertices, atol=0.1 * 2.0**-9 + 1e-12)
+    assert_array_equal(triangles2, triangles)
+    assert os.path.getsize(filename) < (vertices.nbytes + triangles.nbytes) / 4
+
+    with open(filename, "r+b") as fh:
+        fh.truncate(os.path.getsize(filename) - 20)
+    with pytest.raises(RuntimeError):
+        mcubes.load_compact(filename)
+
+    # Header with counts that the blocks cannot hold
+    mcubes.export_compact(vertices[:3], np.array([[0, 1, 2]], dtype=triangles.dtype), filename)
+    with open(filename, "rb") as fh:
+        data = bytearray(fh.read())
+    data[8:12] = (0xffffffff).to_bytes(4, "little")
+    data[60:68] = (0xffffffff).to_bytes(8, "little")
+    with open(filename, "wb") as fh:
+        fh.write(data)
+    with pytest.raises(RuntimeError):
+        mcubes.load_compact(filename)
+
+    # Faces out of range are rejected when writing
+    with pytest.raises(RuntimeError):
+        mcubes.export_compact(vertices[:3], np.array([[0, 1, 3]], dtype=triangles.dtype), filename)
+
+
 def test_invalid_input():
 
     def func(x, y, z):